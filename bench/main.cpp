@@ -0,0 +1,483 @@
+// raster-bench - repeatable benchmarks of the hot paths of the rasterizer and of whole frames, printed as JSON so that
+// runs can be compared against each other. Run it from the repository root, so that the models in objects/ are found:
+//
+//     raster-bench [--filter <substring>] [--min-time <seconds>] [--out <file>]
+
+#include "camera.hpp"
+#include "mesh_optimizer.hpp"
+#include "pipeline_state.hpp"
+#include "primitives.hpp"
+#include "render_context.hpp"
+#include "render_stats.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "types/frame_buffer.hpp"
+#include "types/object.hpp"
+#include "types/transform.hpp"
+#include "types/z_buffer.hpp"
+#include "utils/thread_pool.hpp"
+#include "vertex_stage.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string filter{};  // Only run the benchmarks whose names contain this
+    double min_time{0.5};  // Seconds to keep repeating each benchmark for
+    std::string out_file{}; // Where to write the results - stdout when empty
+};
+
+// The work done by a single run of a benchmark, used to turn its time into rates. Zero counts aren't reported
+struct Work {
+    double triangles{0.};
+    double fragments{0.}; // Pixels that the rasterizer drew
+    double vertices{0.};
+    double pixels{0.};    // Pixels covered in the finished frame
+};
+
+struct Result {
+    std::string name{};
+    std::size_t threads{1};
+    std::size_t iterations{0};
+    double min_ns{0.};
+    double median_ns{0.};
+    Work work{};
+    std::optional<double> speedup{}; // Over the same benchmark on a single thread
+};
+
+class Runner {
+public:
+    explicit Runner(Options options) : m_options{std::move(options)} {}
+
+    bool wants(const std::string& name) const { return name.find(m_options.filter) != std::string::npos; }
+
+    // Times `body` over and over until `min_time` has passed (and at least a few times), after one untimed warm up
+    // run. `setup` runs before every call, outside of the timing
+    template <typename Setup, typename Body>
+    const Result* run(const std::string& name, std::size_t threads, const Work& work, Setup&& setup, Body&& body) {
+        if (!wants(name)) {
+            return nullptr;
+        }
+        std::cerr << "[raster-bench] " << name << " (" << threads << " thread" << (threads == 1 ? "" : "s") << ")"
+                  << std::endl;
+
+        setup();
+        body();
+
+        constexpr std::size_t min_iterations = 5;
+        std::vector<double> samples{};
+        const auto min_time = std::chrono::duration<double>{m_options.min_time};
+        const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(min_time);
+        while (samples.size() < min_iterations || Clock::now() < deadline) {
+            setup();
+            const Clock::time_point start = Clock::now();
+            body();
+            samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+
+        std::sort(samples.begin(), samples.end());
+        m_results.push_back({name, threads, samples.size(), samples.front(), samples[samples.size() / 2], work, {}});
+        return &m_results.back();
+    }
+
+    template <typename Body>
+    const Result* run(const std::string& name, std::size_t threads, const Work& work, Body&& body) {
+        return run(name, threads, work, [] {}, std::forward<Body>(body));
+    }
+
+    // Marks the latest result as a multi-threaded run of `single_threaded`
+    void compare(const Result* single_threaded) {
+        if (single_threaded && !m_results.empty() && &m_results.back() != single_threaded) {
+            m_results.back().speedup = single_threaded->median_ns / m_results.back().median_ns;
+        }
+    }
+
+    // Writes the results to the output file, or to `out` if there isn't one
+    void report(std::ostream& out) const {
+        std::ostringstream json{};
+        json.precision(6);
+        json << "{\n  \"concurrency\": " << ThreadPool::global().concurrency() << ",\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            const Result& result = m_results[i];
+            const double seconds = result.median_ns * 1e-9;
+            json << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+                 << "\", \"threads\": " << result.threads << ", \"iterations\": " << result.iterations
+                 << ", \"min_ns\": " << result.min_ns << ", \"median_ns\": " << result.median_ns;
+
+            auto rate = [&](const char* key, double count) {
+                if (count > 0.) {
+                    json << ", \"" << key << "\": " << count << ", \"" << key << "_per_second\": " << count / seconds;
+                }
+            };
+            rate("triangles", result.work.triangles);
+            rate("fragments", result.work.fragments);
+            rate("vertices", result.work.vertices);
+            rate("pixels", result.work.pixels);
+            if (result.speedup) {
+                json << ", \"speedup\": " << *result.speedup;
+            }
+            json << "}";
+        }
+        json << "\n  ]\n}\n";
+
+        if (m_options.out_file.empty()) {
+            out << json.str();
+            return;
+        }
+        std::ofstream file{m_options.out_file};
+        if (!file) {
+            throw std::runtime_error("Could not open " + m_options.out_file + " for writing");
+        }
+        file << json.str();
+    }
+
+private:
+    Options m_options{};
+    // A deque, so the results that have been handed out stay where they are as more are added
+    std::deque<Result> m_results{};
+};
+
+Options parse_options(int argc, char* argv[]) {
+    Options options{};
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing a value for " + arg);
+        }
+        if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time") {
+            options.min_time = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--out") {
+            options.out_file = argv[++i];
+        } else {
+            throw std::runtime_error("Unknown argument " + arg);
+        }
+    }
+    return options;
+}
+
+// Random triangles of about `size` pixels across, all inside of the frame
+std::vector<std::array<ScreenVertex, 3>> random_triangles(std::size_t count, int size, int width, int height) {
+    std::mt19937 rng{1234}; // Fixed seed, so every run draws the same triangles
+    std::uniform_int_distribution<int> x_dist{0, width - size - 1};
+    std::uniform_int_distribution<int> y_dist{0, height - size - 1};
+    std::uniform_int_distribution<int> offset{0, size};
+    std::uniform_real_distribution<float> depth{-1.f, 1.f};
+
+    std::vector<std::array<ScreenVertex, 3>> triangles(count);
+    for (auto& triangle : triangles) {
+        const Vec2i origin{x_dist(rng), y_dist(rng)};
+        for (auto& vertex : triangle) {
+            vertex = {origin + Vec2i{offset(rng), offset(rng)}, depth(rng)};
+        }
+    }
+    return triangles;
+}
+
+// How many pixels the triangles cover, counting each one as if it was drawn on its own
+double count_fragments(const std::vector<std::array<ScreenVertex, 3>>& triangles, FrameBuffer& frame_buffer,
+                       ZBuffer& z_buffer) {
+    double fragments = 0.;
+    for (const auto& [a, b, c] : triangles) {
+        z_buffer.clear();
+        draw_triangle_filled(a, b, c, frame_buffer, z_buffer, Colors::white);
+
+        // Only the bounding box of the triangle can have been written to
+        const int min_x = std::min({a.position.x(), b.position.x(), c.position.x()});
+        const int max_x = std::max({a.position.x(), b.position.x(), c.position.x()});
+        const int min_y = std::min({a.position.y(), b.position.y(), c.position.y()});
+        const int max_y = std::max({a.position.y(), b.position.y(), c.position.y()});
+        for (int y = min_y; y <= max_y; ++y) {
+            const float* row = z_buffer.row(y);
+            fragments += std::count_if(row + min_x, row + max_x + 1, [](float z) { return std::isfinite(z); });
+        }
+    }
+    return fragments;
+}
+
+void micro_benchmarks(Runner& runner) {
+    constexpr int width = 1024;
+    constexpr int height = 1024;
+    FrameBuffer frame_buffer{width, height};
+    ZBuffer z_buffer{width, height};
+
+    struct TriangleSet {
+        const char* name;
+        std::size_t count;
+        int size;
+    };
+    for (const TriangleSet& set : {TriangleSet{"small", 16384, 8}, TriangleSet{"medium", 1024, 64},
+                                   TriangleSet{"large", 32, 768}}) {
+        const std::string name = std::string{"draw_triangle_filled/"} + set.name;
+        if (!runner.wants(name)) {
+            continue;
+        }
+        const auto triangles = random_triangles(set.count, set.size, width, height);
+        const Work work{.triangles = static_cast<double>(triangles.size()),
+                        .fragments = count_fragments(triangles, frame_buffer, z_buffer)};
+        runner.run(
+            name, 1, work, [&] { z_buffer.clear(); },
+            [&] {
+                for (const auto& [a, b, c] : triangles) {
+                    draw_triangle_filled(a, b, c, frame_buffer, z_buffer, Colors::white);
+                }
+            });
+    }
+
+    if (runner.wants("draw_line")) {
+        std::mt19937 rng{1234};
+        std::uniform_real_distribution<float> coordinate{-0.9f, 0.9f};
+        std::vector<std::array<Vec3f, 2>> lines(4096);
+        double fragments = 0.;
+        for (auto& [a, b] : lines) {
+            a = Vec3f{coordinate(rng), coordinate(rng), 0.f};
+            b = Vec3f{coordinate(rng), coordinate(rng), 0.f};
+            const Vec2i a_screen = to_screen_space(a, width, height);
+            const Vec2i b_screen = to_screen_space(b, width, height);
+            fragments += std::max(std::abs(a_screen.x() - b_screen.x()), std::abs(a_screen.y() - b_screen.y())) + 1;
+        }
+        runner.run("draw_line", 1, Work{.fragments = fragments}, [&] {
+            for (const auto& [a, b] : lines) {
+                draw_line(a, b, frame_buffer, Colors::white);
+            }
+        });
+    }
+
+    if (runner.wants("vertex_stage")) {
+        const Object sphere = Object::sphere(1024, 512);
+        Camera camera{};
+        camera.set_position({0.f, 0.f, -4.f});
+        const Matrix4x4f model_view = camera.view_matrix() * sphere.transform_matrix();
+        const Matrix4x4f projection = camera.projection_matrix(1.f);
+        VertexStreams vertices{};
+        runner.run("vertex_stage", 1, Work{.vertices = static_cast<double>(sphere.vertices().size())}, [&] {
+            run_vertex_stage(sphere.vertices(), model_view, projection, width, height, vertices);
+        });
+    }
+
+    for (const char* model : {"body", "diablo3_post"}) {
+        const std::string name = std::string{"load_obj/"} + model;
+        if (!runner.wants(name)) {
+            continue;
+        }
+        const std::string path = std::string{"objects/"} + model + ".obj";
+        Object object{};
+        object.load_obj(path);
+        runner.run(name, 1, Work{.triangles = static_cast<double>(object.faces().size())}, [&] {
+            Object loaded{};
+            loaded.load_obj(path);
+        });
+    }
+}
+
+void frame_benchmarks(Runner& runner) {
+    struct Frame {
+        std::string name;
+        Object (*load)();
+        Vec3f camera_position;
+        PipelineState::Mode mode;
+    };
+    using Mode = PipelineState::Mode;
+    const std::vector<Frame> frames{
+        {"frame/body/normals", [] { return Object{"objects/body.obj"}; }, {0.f, 0.f, -4.f}, Mode::Normals},
+        {"frame/diablo3_post/normals", [] { return Object{"objects/diablo3_post.obj"}; }, {0.f, 0.f, -4.f},
+         Mode::Normals},
+        {"frame/diablo3_post/shaded", [] { return Object{"objects/diablo3_post.obj"}; }, {0.f, 0.f, -4.f},
+         Mode::Shaded},
+        {"frame/diablo3_post/wireframe", [] { return Object{"objects/diablo3_post.obj"}; }, {0.f, 0.f, -4.f},
+         Mode::Wireframe},
+        // About a million triangles of a few pixels each
+        {"frame/sphere/normals", [] { return Object::sphere(1024, 512); }, {0.f, 0.f, -4.f}, Mode::Normals},
+        // A few triangles that fill the whole frame
+        {"frame/cube/normals", [] { return Object::cube(); }, {0.f, 0.f, -1.5f}, Mode::Normals},
+    };
+
+    const std::size_t concurrency = ThreadPool::global().concurrency();
+    for (const Frame& frame : frames) {
+        if (!runner.wants(frame.name)) {
+            continue;
+        }
+        const Object object = frame.load();
+        Camera camera{};
+        camera.set_position(frame.camera_position);
+
+        FrameBuffer frame_buffer{1500, 1500};
+        RenderStats stats{};
+        Renderer::draw(object, camera, frame_buffer, PipelineState{.mode = frame.mode}, &stats);
+        const Work work{.triangles = static_cast<double>(stats.triangles_submitted),
+                        .fragments = static_cast<double>(stats.fragments_passed),
+                        .pixels = static_cast<double>(stats.pixels_covered)};
+
+        // On pools of 1, 2, 4, ... threads up to the whole machine (counting the calling thread), to see how well it
+        // scales. Each count gets a pool and a context of its own
+        std::vector<std::size_t> thread_counts{};
+        for (std::size_t threads = 1; threads < concurrency; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(concurrency);
+
+        const Result* single_threaded = nullptr;
+        const PipelineState state{.mode = frame.mode};
+        for (const std::size_t threads : thread_counts) {
+            ThreadPool pool{threads - 1};
+            RenderContext context{pool};
+            const Result* result = runner.run(frame.name, threads, work, [&] {
+                Renderer::draw(context, object, camera, frame_buffer, state);
+            });
+            if (threads == 1) {
+                single_threaded = result;
+            } else {
+                runner.compare(single_threaded);
+            }
+        }
+    }
+}
+
+// The same scene from many cameras at once, against drawing the views one after the other
+void multiview_benchmarks(Runner& runner) {
+    const std::string name = "multiview/diablo3_post/24_views";
+    if (!runner.wants(name)) {
+        return;
+    }
+
+    Scene scene{};
+    scene.add(Object{"objects/diablo3_post.obj"});
+    scene.build();
+
+    // A ring of cameras around the model, like a capture of a product from every angle
+    constexpr int view_count = 24;
+    std::vector<Camera> cameras(view_count);
+    std::vector<FrameBuffer> frame_buffers{};
+    for (int i = 0; i < view_count; ++i) {
+        const float angle = 2.f * std::numbers::pi_v<float> * static_cast<float>(i) / view_count;
+        cameras[i].set_position({4.f * std::sin(angle), 0.f, -4.f * std::cos(angle)});
+        frame_buffers.emplace_back(512, 512);
+    }
+
+    const PipelineState state{.mode = PipelineState::Mode::Shaded};
+    std::vector<RenderStats> stats(view_count);
+    Renderer::draw(scene, cameras, frame_buffers, state, stats);
+    Work work{};
+    for (const RenderStats& view : stats) {
+        work.triangles += static_cast<double>(view.triangles_submitted);
+        work.fragments += static_cast<double>(view.fragments_passed);
+        work.pixels += static_cast<double>(view.pixels_covered);
+    }
+
+    const std::size_t concurrency = ThreadPool::global().concurrency();
+    runner.run(name + "/separate", concurrency, work, [&] {
+        for (int i = 0; i < view_count; ++i) {
+            Renderer::draw(scene, cameras[i], frame_buffers[i], state);
+        }
+    });
+    runner.run(name + "/shared", concurrency, work, [&] { Renderer::draw(scene, cameras, frame_buffers, state); });
+}
+
+// A field of the same mesh repeated many times, drawn as separate objects against one instanced draw
+void instancing_benchmarks(Runner& runner) {
+    const std::string name = "instancing/sphere/10000_instances";
+    if (!runner.wants(name)) {
+        return;
+    }
+
+    // A 100 by 100 grid of spheres on the ground, seen from above one edge of it
+    const Object mesh = Object::sphere(32, 16);
+    std::vector<Transform> transforms{};
+    std::vector<Object> objects{};
+    for (int row = 0; row < 100; ++row) {
+        for (int column = 0; column < 100; ++column) {
+            Transform& transform = transforms.emplace_back();
+            transform.position = Vec3f{2.5f * static_cast<float>(column - 50), 0.f, 2.5f * static_cast<float>(row)};
+            transform.rotation = Vec3f{0.f, 0.1f * static_cast<float>(row + column), 0.f};
+            objects.push_back(mesh);
+            objects.back().set_transform(transform);
+        }
+    }
+    Camera camera{};
+    camera.set_position({0.f, 10.f, -15.f});
+    camera.set_target({0.f, 0.f, 20.f});
+
+    FrameBuffer frame_buffer{1500, 1500};
+    const PipelineState state{.mode = PipelineState::Mode::Shaded};
+    RenderStats stats{};
+    Renderer::draw(objects, camera, frame_buffer, state, &stats);
+    const Work work{.triangles = static_cast<double>(stats.triangles_submitted),
+                    .fragments = static_cast<double>(stats.fragments_passed),
+                    .pixels = static_cast<double>(stats.pixels_covered)};
+
+    const std::size_t concurrency = ThreadPool::global().concurrency();
+    const Result* separate = runner.run(name + "/objects", concurrency, work,
+                                        [&] { Renderer::draw(objects, camera, frame_buffer, state); });
+    runner.run(name + "/instanced", concurrency, work,
+               [&] { Renderer::draw_instanced(mesh, transforms, camera, frame_buffer, state); });
+    runner.compare(separate);
+}
+
+// A mesh with its faces in no useful order, drawn as it is against after the optimizer has reordered it
+void optimizer_benchmarks(Runner& runner) {
+    const std::string name = "optimizer/shuffled_sphere/normals";
+    if (!runner.wants(name)) {
+        return;
+    }
+
+    const Object sphere = Object::sphere(1024, 512);
+    std::vector<Object::Face> faces{sphere.faces().begin(), sphere.faces().end()};
+    std::shuffle(faces.begin(), faces.end(), std::mt19937{7});
+    const Object shuffled{std::vector<Vec3f>{sphere.vertices().begin(), sphere.vertices().end()}, std::move(faces)};
+    const Object optimized = MeshOptimizer::optimize(shuffled);
+
+    Camera camera{};
+    camera.set_position({0.f, 0.f, -4.f});
+    FrameBuffer frame_buffer{1500, 1500};
+    const PipelineState state{.mode = PipelineState::Mode::Normals};
+    RenderStats stats{};
+    Renderer::draw(shuffled, camera, frame_buffer, state, &stats);
+    const Work work{.triangles = static_cast<double>(stats.triangles_submitted),
+                    .fragments = static_cast<double>(stats.fragments_passed),
+                    .pixels = static_cast<double>(stats.pixels_covered)};
+
+    const std::size_t concurrency = ThreadPool::global().concurrency();
+    const Result* original = runner.run(name + "/original", concurrency, work,
+                                        [&] { Renderer::draw(shuffled, camera, frame_buffer, state); });
+    runner.run(name + "/optimized", concurrency, work,
+               [&] { Renderer::draw(optimized, camera, frame_buffer, state); });
+    runner.compare(original);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // The library logs to stdout (like every model it loads), so keep stdout to ourselves for the results
+    std::ostream results{std::cout.rdbuf(nullptr)};
+
+    try {
+        Runner runner{parse_options(argc, argv)};
+        micro_benchmarks(runner);
+        frame_benchmarks(runner);
+        multiview_benchmarks(runner);
+        instancing_benchmarks(runner);
+        optimizer_benchmarks(runner);
+        runner.report(results);
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
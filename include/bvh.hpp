@@ -0,0 +1,65 @@
+#pragma once
+
+#include "types/bounds.hpp"
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// A bounding volume hierarchy over a set of boxes ("items"), built top-down by splitting each node at the median of its
+// longest axis. Leaves hold up to `leaf_size` items, so a hierarchy over faces can double as a split into clusters
+class Bvh {
+public:
+    struct Node {
+        Bounds3f bounds{};
+        std::uint32_t first{0}; // The first of the two children for inner nodes, or the first item for leaves
+        std::uint32_t count{0}; // The number of items in a leaf - 0 for inner nodes
+    };
+
+    Bvh() = default;
+    explicit Bvh(std::span<const Bounds3f> item_bounds, std::size_t leaf_size = 1);
+
+    bool empty() const { return m_nodes.empty(); }
+    const std::vector<Node>& nodes() const { return m_nodes; }
+
+    // The items in a leaf, as indexes into the boxes the hierarchy was built from
+    std::span<const std::uint32_t> items(const Node& leaf) const { return {m_items.data() + leaf.first, leaf.count}; }
+
+    // Calls `leaf(items)` for every leaf that can be reached through nodes that pass `visible(bounds)`, nearest first
+    // going by `distance(bounds)`. Nodes are only tested when they are reached, so `visible` can depend on what the
+    // leaves before them have done (like drawing into a depth buffer)
+    template <typename Visible, typename Distance, typename Leaf>
+    void traverse(Visible&& visible, Distance&& distance, Leaf&& leaf) const {
+        if (m_nodes.empty()) {
+            return;
+        }
+
+        std::vector<std::uint32_t> stack{0};
+        while (!stack.empty()) {
+            const Node& node = m_nodes[stack.back()];
+            stack.pop_back();
+
+            if (!visible(node.bounds)) {
+                continue;
+            }
+            if (node.count > 0) {
+                leaf(items(node));
+                continue;
+            }
+
+            // Push the farther child first, so the nearer one is visited first
+            std::uint32_t near = node.first;
+            std::uint32_t far = node.first + 1;
+            if (distance(m_nodes[far].bounds) < distance(m_nodes[near].bounds)) {
+                std::swap(near, far);
+            }
+            stack.push_back(far);
+            stack.push_back(near);
+        }
+    }
+
+private:
+    std::vector<Node> m_nodes{};
+    std::vector<std::uint32_t> m_items{};
+};
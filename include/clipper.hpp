@@ -0,0 +1,57 @@
+#pragma once
+
+#include "primitives.hpp"
+#include "types/bounds.hpp"
+#include "types/matrix.hpp"
+#include "types/vec.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Clip codes have a bit set for every plane that a clip space point (x, y, z, w) is on the outside of. The view frustum
+// is -w <= x, y, z <= w, with z = w on the near plane. The guard band is a wider version of the frustum's sides -
+// triangles that poke out of the frustum but stay inside of it are left for the rasterizer to clip to the screen
+namespace ClipCode {
+
+constexpr std::int32_t negative_x = 1 << 0;
+constexpr std::int32_t positive_x = 1 << 1;
+constexpr std::int32_t negative_y = 1 << 2;
+constexpr std::int32_t positive_y = 1 << 3;
+constexpr std::int32_t near = 1 << 4;
+constexpr std::int32_t far = 1 << 5;
+constexpr std::int32_t guard_negative_x = 1 << 6;
+constexpr std::int32_t guard_positive_x = 1 << 7;
+constexpr std::int32_t guard_negative_y = 1 << 8;
+constexpr std::int32_t guard_positive_y = 1 << 9;
+
+constexpr std::int32_t frustum = negative_x | positive_x | negative_y | positive_y | near | far;
+// A triangle with a vertex outside of any of these has to be clipped before it can be rasterized
+constexpr std::int32_t needs_clipping = near | far | guard_negative_x | guard_positive_x | guard_negative_y |
+                                        guard_positive_y;
+
+} // namespace ClipCode
+
+// How far past the edges of the frame the guard band reaches, in pixels. It also bounds the pixel coordinates that
+// reach the rasterizer, which keeps its integer edge functions from overflowing
+constexpr float guard_band_pixels = 4096.f;
+
+// The guard band's half extents in NDC, for a frame of the given size
+Vec2f guard_band(int width, int height);
+
+std::int32_t clip_code(const Vec4f& clip, const Vec2f& guard_band);
+
+// Whether the whole box is outside of one of the frustum's planes, once transformed by `mvp`
+bool outside_frustum(const Bounds3f& bounds, const Matrix4x4f& mvp);
+
+// What is left of a triangle after clipping, ready to be rasterized
+struct ClippedTriangle {
+    std::array<Vec3f, 3> ndc{};
+    std::array<ScreenVertex, 3> screen{};
+    std::uint32_t face{0}; // The face that it was clipped from
+};
+
+// Clips a triangle in clip space against the planes in `codes` (the clip codes of its vertices or'd together) that
+// need clipping, and appends the fan of triangles that is left over to `out`
+void clip_triangle(const std::array<Vec4f, 3>& triangle, std::int32_t codes, const Vec2f& guard_band, int width,
+                   int height, std::uint32_t face, std::vector<ClippedTriangle>& out);
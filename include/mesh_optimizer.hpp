@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types/object.hpp"
+#include "types/vec.hpp"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Offline passes that reorder a mesh so that the renderer touches memory in order while drawing it, without changing
+// what it looks like. Each face keeps its corners in the same order, so it still winds the same way
+namespace MeshOptimizer {
+
+// Merges vertices at exactly the same position into the first of them, and drops the others. Returns how many were
+// dropped
+std::size_t weld_vertices(std::vector<Vec3f>& vertices, std::vector<Object::Face>& faces);
+
+// Reorders the faces so that the ones sharing vertices are drawn close together, for a cache that holds the last
+// `cache_size` vertices used. This is Tipsify (Sander et al. 2007), which takes time linear in the size of the mesh
+void optimize_face_order(std::vector<Object::Face>& faces, std::size_t vertex_count, std::size_t cache_size = 32);
+
+// Reorders the vertices into the order that the faces first use them, and drops any that no face uses
+void optimize_vertex_order(std::vector<Vec3f>& vertices, std::vector<Object::Face>& faces);
+
+// How many vertices per face miss a first-in first-out cache of `cache_size` vertices - 3 at worst, and close to 0.5
+// for a well ordered mesh of a regular grid
+float cache_miss_ratio(std::span<const Object::Face> faces, std::size_t vertex_count, std::size_t cache_size = 32);
+
+// Runs all of the passes above in turn, keeping the transform of the object
+Object optimize(const Object& object);
+
+} // namespace MeshOptimizer
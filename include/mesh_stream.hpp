@@ -0,0 +1,53 @@
+#pragma once
+
+#include "types/bounds.hpp"
+#include "types/mesh_file.hpp"
+#include "types/object.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A mesh that stays on disk in a chunked mesh file, and is read a chunk at a time while it is drawn - so meshes that
+// don't fit into memory can still be drawn, in as little memory as a few chunks take up
+class MeshStream {
+public:
+    // Splits a .obj or .rrmesh file into chunks of up to `faces_per_chunk` faces and writes them to `destination`.
+    // An .obj file is parsed a block at a time and never held in memory as a whole
+    static void convert(const std::string& source, const std::string& destination,
+                        std::size_t faces_per_chunk = 65536);
+
+    // Whether `destination` exists and was converted from the current version of `source` - converting again can take
+    // a long time for the meshes this is for
+    static bool is_fresh(const std::string& destination, const std::string& source);
+
+    // Reads the chunk table of a chunked mesh file. At most `chunks_in_flight` chunks are held in memory at once while
+    // drawing - one is drawn while the others are read ahead of it
+    explicit MeshStream(const std::string& filename, std::size_t chunks_in_flight = 2);
+
+    const std::string& filename() const { return m_filename; }
+    std::size_t chunk_count() const { return m_chunks.size(); }
+    std::size_t chunks_in_flight() const { return m_chunks_in_flight; }
+
+    std::uint64_t vertex_count() const { return m_vertex_count; }
+    std::uint64_t face_count() const { return m_face_count; }
+
+    // The object space bounds of the whole mesh, and of a single chunk
+    const Bounds3f& bounds() const { return m_bounds; }
+    const Bounds3f& chunk_bounds(std::size_t index) const { return m_chunk_bounds[index]; }
+
+    // Reads a chunk from disk into an object of its own. Safe to call from several threads at once
+    Object read_chunk(std::size_t index) const;
+
+private:
+    std::string m_filename{};
+    std::size_t m_chunks_in_flight{2};
+
+    std::vector<ChunkRecord> m_chunks{};
+    std::vector<Bounds3f> m_chunk_bounds{};
+
+    std::uint64_t m_vertex_count{0};
+    std::uint64_t m_face_count{0};
+    Bounds3f m_bounds{};
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+// Everything about how a draw call rasterizes that can be picked at runtime. The renderer looks at it once per draw and
+// dispatches to an inner loop that was compiled for that exact combination, so none of these options cost a branch
+// per triangle or per pixel
+struct PipelineState {
+    enum class Mode { Wireframe, Shaded, Normals };
+
+    Mode mode{Mode::Normals};  // Wireframe edges, or filled triangles with either Lambert shading or their normals
+    bool cull_backfaces{false}; // Skip the faces that point away from the camera
+    bool depth_test{true};      // Only draw the pixels that are closer than what is already in the z buffer
+    bool depth_write{true};     // Keep the depths of the pixels that are drawn in the z buffer
+    bool parallelize{true};     // Bin and rasterize on the global thread pool rather than the calling thread
+
+    bool operator==(const PipelineState& other) const = default;
+};
@@ -2,19 +2,52 @@
 
 #include "types/color.hpp"
 #include "types/frame_buffer.hpp"
+#include "types/rect.hpp"
 #include "types/vec.hpp"
 #include "types/z_buffer.hpp"
 
+#include <cstdint>
+
+// Converts a point in normalized device coordinates to pixel coordinates
+Vec2i to_screen_space(const Vec3f& ndc, int width, int height);
+
 // Convenience function to draw a horizontal line - faster than draw_line due to the assumptions we can make
 void draw_line_horizontal(int a_x, int b_x, int y, float z0, float z1, FrameBuffer& frame_buffer, ZBuffer& z_buffer,
                           const Color3& color);
 
 // Draws a line using Bresenham's algorithm
 void draw_line(Vec3f a, Vec3f b, FrameBuffer& frame_buffer, const Color3& color);
+// Same as above, but only touches the pixels inside of `clip`
+void draw_line(Vec3f a, Vec3f b, FrameBuffer& frame_buffer, const Color3& color, const Rect2i& clip);
 
 // Draws the 3 edges that connect the vertices
 void draw_triangle(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, const Color3& color);
+void draw_triangle(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, const Color3& color,
+                   const Rect2i& clip);
+
+// A vertex that has already been projected onto the screen
+struct ScreenVertex {
+    Vec2i position{0, 0}; // In pixels
+    float depth{0.f};     // The NDC depth - larger is closer
+};
+
+// Draws a filled triangle, testing a whole SIMD batch of pixels against its edge functions per step
+// Pixels are written without any locking - concurrent callers must draw into disjoint `clip` regions
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color);
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color, const Rect2i& clip);
+
+// How many pixels filled triangles have gone through, for statistics
+struct FragmentCounters {
+    std::uint64_t tested{0}; // Covered pixels that went through the depth test
+    std::uint64_t passed{0}; // Covered pixels that were drawn
+};
 
-// Draws filled rectangle using scanline rendering
-void draw_triangle_filled(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, ZBuffer& z_buffer,
-                          const Color3& color);
\ No newline at end of file
+// Same as above, with the depth test and the depth writes turned on or off at compile time. Without the test every
+// covered pixel is drawn, and without the writes the z buffer is left as it was. The pixels are added onto `counters`
+// when it isn't null
+template <bool DepthTest, bool DepthWrite>
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color, const Rect2i& clip,
+                          FragmentCounters* counters);
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "clipper.hpp"
+#include "pipeline_state.hpp"
+#include "tile_binner.hpp"
+#include "types/frame_buffer.hpp"
+#include "types/matrix.hpp"
+#include "types/rect.hpp"
+#include "types/vec.hpp"
+#include "types/z_buffer.hpp"
+#include "utils/thread_pool.hpp"
+#include "vertex_stage.hpp"
+
+#include <memory>
+#include <vector>
+
+// Everything that a draw keeps between draws - the z buffer and the scratch buffers of each stage, which hold on to
+// their capacity - and the thread pool that it runs on. Draws through different contexts share no mutable state, so
+// they can run at the same time into different frame buffers, even on the same pool. A context is only ever used by
+// one draw at a time
+class RenderContext {
+public:
+    explicit RenderContext(ThreadPool& pool = ThreadPool::global()) : m_pool{&pool} {}
+
+    RenderContext(const RenderContext&) = delete;
+    RenderContext& operator=(const RenderContext&) = delete;
+
+    // Holds on to a context of the calling thread for as long as it lives
+    class Lease {
+    public:
+        explicit Lease(RenderContext& context) : m_context{&context} {}
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        RenderContext& operator*() const { return *m_context; }
+        RenderContext* operator->() const { return m_context; }
+
+    private:
+        RenderContext* m_context;
+    };
+
+    // A context of the calling thread that no other draw is using, for the draws that aren't given one. A draw that
+    // waits on the pool can run a queued task that starts another draw on the same thread, so every level of nesting
+    // gets a context of its own - kept for the next draw at that level, so its buffers stay warm
+    static Lease for_this_thread();
+
+    ThreadPool& pool() const { return *m_pool; }
+
+    // The depths left behind by the last draw
+    const ZBuffer& z_buffer() const { return m_z_buffer; }
+    ZBuffer& z_buffer() { return m_z_buffer; }
+
+    // Clears the z buffer for a new draw, only re-allocating it when the size of the target has changed. This forgets
+    // the last frame of incremental draws too
+    ZBuffer& cleared_z_buffer(int width, int height);
+
+    TileBinner& binner() { return m_binner; }
+    VertexStreams& vertices() { return m_vertices; }
+    // The triangles that each binning stream had to clip
+    std::vector<std::vector<ClippedTriangle>>& clipped() { return m_clipped; }
+
+    // One of the contexts that the views of a multi-view draw go through - made on first use, on the same pool
+    RenderContext& view(std::size_t index);
+    // The world space normals of the faces of each object, shared by all of the views of a multi-view draw
+    std::vector<std::vector<Vec3f>>& face_normals() { return m_face_normals; }
+
+    // What an incremental draw needs to know about the last frame that it drew, to only redraw what has changed
+    struct History {
+        bool valid{false};
+        const FrameBuffer* target{nullptr};
+        Matrix4x4f view{};
+        Matrix4x4f projection{};
+        PipelineState state{};
+        std::vector<Rect2i> object_rects{}; // The pixels that each object may have drawn to
+
+        // Scratch space for the tiles being redrawn
+        std::vector<std::uint8_t> dirty{};
+        std::vector<std::uint32_t> dirty_tiles{};
+    };
+    History& history() { return m_history; }
+
+    // Scratch space for instanced draws
+    struct Instances {
+        std::vector<Matrix4x4f> models{};   // Built from the transforms of the instances
+        std::vector<float> nearest{};       // How far away each instance is, or infinity when it's out of view
+        std::vector<std::uint32_t> order{}; // The instances in view, nearest first
+    };
+    Instances& instances() { return m_instances; }
+
+private:
+    ThreadPool* m_pool;
+    ZBuffer m_z_buffer{0, 0};
+    TileBinner m_binner{};
+    VertexStreams m_vertices{};
+    std::vector<std::vector<ClippedTriangle>> m_clipped{};
+    std::vector<std::unique_ptr<RenderContext>> m_views{};
+    std::vector<std::vector<Vec3f>> m_face_normals{};
+    History m_history{};
+    Instances m_instances{};
+};
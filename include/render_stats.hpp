@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// What a draw did, filled in by Renderer::draw when it is given somewhere to put it. Every field adds up over all of
+// the objects in the draw. When no stats are asked for nothing is timed, and the only cost is a check per binning and
+// raster task
+struct RenderStats {
+    // How long each stage took, in nanoseconds of wall time
+    struct StageTimes {
+        double vertex_ns{0.};
+        double bin_ns{0.};
+        double raster_ns{0.};
+        double total_ns{0.}; // The whole draw, including the culling of objects and clusters
+    };
+
+    // How one of the threads that took part in binning and rasterizing spent its time
+    struct ThreadTimes {
+        double busy_ns{0.}; // Running binning and raster tasks
+        double idle_ns{0.}; // Waiting for the other threads to finish theirs
+    };
+
+    StageTimes times{};
+
+    std::uint64_t objects_submitted{0};
+    std::uint64_t objects_culled{0}; // Out of view or hidden, so none of their faces were looked at
+
+    std::uint64_t triangles_submitted{0};
+    std::uint64_t triangles_culled_backface{0};
+    std::uint64_t triangles_culled_frustum{0};   // All 3 vertices outside of the same plane
+    std::uint64_t triangles_culled_zero_area{0}; // Degenerate once snapped to pixels
+    std::uint64_t triangles_clipped{0};          // Crossed the near plane, far plane or guard band
+
+    std::uint64_t fragments_tested{0}; // Covered pixels that went through the depth test
+    std::uint64_t fragments_passed{0}; // Covered pixels that were drawn
+    std::uint64_t pixels_covered{0};   // Pixels of the frame that have a depth at the end of the draw
+
+    // Indexed like ThreadPool::thread_index
+    std::vector<ThreadTimes> threads{};
+
+    // How many times each covered pixel was drawn to, on average
+    double overdraw() const {
+        return pixels_covered == 0 ? 0. : static_cast<double>(fragments_passed) / static_cast<double>(pixels_covered);
+    }
+};
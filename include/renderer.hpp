@@ -1,13 +1,87 @@
 #pragma once
 
 #include "camera.hpp"
+#include "mesh_stream.hpp"
+#include "pipeline_state.hpp"
+#include "render_context.hpp"
+#include "render_stats.hpp"
+#include "scene.hpp"
 #include "types/frame_buffer.hpp"
+#include "types/matrix.hpp"
 #include "types/object.hpp"
+#include "types/transform.hpp"
+
+#include <span>
+#include <vector>
 
 class Renderer {
 public:
-    enum class Mode { Wireframe, Shaded, Normals };
+    using Mode = PipelineState::Mode;
 
+    // Draws with the default state for the mode
     static void draw(const Object& object, const Camera& camera, FrameBuffer& frame_buffer, Mode mode);
     static void draw(const std::vector<Object>& object, const Camera& camera, FrameBuffer& frame_buffer, Mode mode);
+    static void draw(const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer, Mode mode);
+
+    // Draws through the context of the calling thread
+    static void draw(const Object& object, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+    static void draw(const std::vector<Object>& object, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+    static void draw(const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                     RenderStats* stats = nullptr);
+    static void draw(const Scene& scene, std::span<const Camera> cameras, std::span<FrameBuffer> frame_buffers,
+                     const PipelineState& state, std::span<RenderStats> stats = {});
+    static void draw(const MeshStream& mesh, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+
+    static void draw_incremental(const std::vector<Object>& objects, std::span<const std::size_t> changed,
+                                 const Camera& camera, FrameBuffer& frame_buffer, const Color3& background,
+                                 const PipelineState& state, RenderStats* stats = nullptr);
+    static void draw_instanced(const Object& mesh, std::span<const Transform> instances, const Camera& camera,
+                               FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats = nullptr);
+    static void draw_instanced(const Object& mesh, std::span<const Matrix4x4f> instances, const Camera& camera,
+                               FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats = nullptr);
+
+    // `stats`, when given, is reset and then filled in with what the draw did
+    static void draw(RenderContext& context, const Object& object, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+    static void draw(RenderContext& context, const std::vector<Object>& object, const Camera& camera,
+                     FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats = nullptr);
+    // Draws the objects and clusters of faces that are in view, front to back, skipping those that are hidden behind
+    // what has already been drawn. The scene has to have been built
+    static void draw(RenderContext& context, const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+    // Draws the scene once for every camera, into the frame buffer at the same index. What doesn't depend on the view,
+    // like the normals of the faces, is worked out once for all of them, and then the views are drawn in parallel
+    // through contexts that `context` keeps for them. `stats`, when given, needs an entry for every view
+    static void draw(RenderContext& context, const Scene& scene, std::span<const Camera> cameras,
+                     std::span<FrameBuffer> frame_buffers, const PipelineState& state,
+                     std::span<RenderStats> stats = {});
+    // Draws a mesh that stays on disk, one chunk after the other. The chunks in view are read ahead on the pool while
+    // the one before them is drawn, but never more than `mesh.chunks_in_flight()` are in memory at once - so the
+    // memory the draw takes is bounded by the size of the chunks rather than the mesh. Chunks count as objects in
+    // `stats`
+    static void draw(RenderContext& context, const MeshStream& mesh, const Camera& camera, FrameBuffer& frame_buffer,
+                     const PipelineState& state, RenderStats* stats = nullptr);
+
+    // Redraws the frame that the last incremental draw through `context` left in `frame_buffer`, where only the objects
+    // at the indexes in `changed` may have changed since. Just the tiles those objects covered then or cover now are
+    // cleared to `background` and drawn again, and the rest of the frame buffer and z buffer is kept. Anything else
+    // that changed - the camera, the frame buffer, the state or the number of objects - redraws the whole frame, as
+    // does any other draw through the context in between. "Objects culled" in `stats` counts the ones left as they were
+    static void draw_incremental(RenderContext& context, const std::vector<Object>& objects,
+                                 std::span<const std::size_t> changed, const Camera& camera, FrameBuffer& frame_buffer,
+                                 const Color3& background, const PipelineState& state, RenderStats* stats = nullptr);
+
+    // Draws `mesh` once for every instance, placed by the instance's transform (or model matrix) on top of the mesh's
+    // own. All of the instances share the vertices and faces of the mesh. Their matrices are built in one batch up
+    // front, and the instances out of view - or hidden behind those already drawn - are culled before any of their
+    // vertices are transformed. The rest are drawn nearest first. Instances count as objects in `stats`
+    static void draw_instanced(RenderContext& context, const Object& mesh, std::span<const Transform> instances,
+                               const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                               RenderStats* stats = nullptr);
+    static void draw_instanced(RenderContext& context, const Object& mesh, std::span<const Matrix4x4f> instances,
+                               const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                               RenderStats* stats = nullptr);
 };
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "bvh.hpp"
+#include "types/bounds.hpp"
+#include "types/object.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// A set of objects with a bounding volume hierarchy over them, so that a renderer can skip the objects that are out of
+// view or hidden and draw the rest front to back. Every object also gets a hierarchy over its own faces, with leaves of
+// up to `cluster_size` nearby faces, so the same can be done for the parts of a large mesh
+class Scene {
+public:
+    static constexpr std::size_t cluster_size = 256;
+
+    Scene() = default;
+
+    // Adds an object and returns its index - the hierarchy over the objects is rebuilt on the next call to `build`
+    std::size_t add(Object object);
+
+    // Builds the hierarchies over everything added since the last build
+    void build();
+
+    const std::vector<Object>& objects() const { return m_objects; }
+
+    // Over the world space bounds of the objects
+    const Bvh& object_bvh() const { return m_object_bvh; }
+    // Over the object space bounds of an object's faces
+    const Bvh& face_bvh(std::size_t object) const { return m_face_bvhs[object]; }
+
+private:
+    std::vector<Object> m_objects{};
+    std::vector<Bvh> m_face_bvhs{};
+    Bvh m_object_bvh{};
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "camera.hpp"
+#include "pipeline_state.hpp"
+#include "types/frame_buffer.hpp"
+#include "types/object.hpp"
+#include "types/vec.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Renders animations of many frames. Handing a finished frame to its sink (encoding and writing it out, say) runs on
+// the thread pool while the next frame is drawn
+namespace Sequence {
+
+struct Settings {
+    int width{1500};
+    int height{1500};
+    int frame_count{1};
+    Color3 background{Colors::black};
+    FrameBuffer::Format format{FrameBuffer::Format::RGB32F};
+    PipelineState state{};
+};
+
+// Moves the camera and the objects to where they are on `frame`, right before it is drawn
+using Animation = std::function<void(int frame, Camera& camera, std::vector<Object>& objects)>;
+
+// Takes each finished frame. Frames arrive in order and one at a time, but on a thread of the pool rather than the one
+// that is drawing, so the frame buffer is only valid until the call returns
+using Sink = std::function<void(int frame, const FrameBuffer& frame_buffer)>;
+
+// Draws `settings.frame_count` frames. The same two frame buffers are drawn into for the whole sequence - one is with
+// the sink while the other is drawn into - and the renderer keeps reusing its own buffers between the draws as usual.
+// Returns once the sink has taken the last frame, rethrowing the first error from either side
+void render(std::vector<Object> objects, Camera camera, const Settings& settings, const Animation& animate,
+            const Sink& sink);
+
+// Circles the camera around `target` once over `frame_count` frames, `radius` away and `height` above it
+Animation turntable(const Vec3f& target, float radius, float height, int frame_count);
+
+// Writes each frame to its own image file, named by formatting the frame number into `pattern` printf style - like
+// "frames/frame_%04d.png". The image format is picked from the extension, and missing directories are created
+Sink image_files(std::string pattern);
+
+// Streams the frames as one uncompressed Y4M video to a file, or to stdout for a filename of "-" - ready to be piped
+// into an encoder, like `raster-rise --turntable 120 - | ffmpeg -i - turntable.mp4`. Missing directories are created
+Sink video_stream(const std::string& filename, int width, int height, int frames_per_second = 30);
+
+} // namespace Sequence
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types/rect.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Sorts triangles into fixed-size screen tiles so that each tile can be rasterized independently by one thread.
+// Binning is split into streams - each stream may be filled concurrently by a different thread, and triangles are
+// visited per tile in stream order, so submission order (and therefore depth tie-breaking) is preserved.
+class TileBinner {
+public:
+    static constexpr int tile_size = 64;
+
+    TileBinner() = default;
+
+    // Empties all bins and resizes the tile grid, keeping the allocated bin capacity for reuse
+    void reset(int width, int height, std::size_t num_streams);
+
+    // Records that triangle `id` covers (some of) the pixels in `bounds`
+    void bin(std::size_t stream, std::uint32_t id, const Rect2i& bounds);
+
+    int tile_count() const { return m_tiles_x * m_tiles_y; }
+    std::size_t stream_count() const { return m_num_streams; }
+
+    // The pixels owned by the tile, clamped to the size of the target
+    Rect2i tile_rect(int tile) const;
+
+    // Calls `func(id)` for every triangle binned to `tile`, in submission order
+    template <typename F> void for_each(int tile, F&& func) const {
+        for (std::size_t stream = 0; stream < m_num_streams; ++stream) {
+            for (std::uint32_t id : m_bins[stream * tile_count() + tile]) {
+                func(id);
+            }
+        }
+    }
+
+private:
+    int m_width{0};
+    int m_height{0};
+    int m_tiles_x{0};
+    int m_tiles_y{0};
+    std::size_t m_num_streams{0};
+
+    // Indexed by `stream * tile_count() + tile`
+    std::vector<std::vector<std::uint32_t>> m_bins{};
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "types/vec.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <span>
+
+// An axis-aligned bounding box - empty until a point has been added
+struct Bounds3f {
+    Vec3f min{std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+              std::numeric_limits<float>::infinity()};
+    Vec3f max{-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+              -std::numeric_limits<float>::infinity()};
+
+    bool empty() const { return min.x() > max.x() || min.y() > max.y() || min.z() > max.z(); }
+
+    void add(const Vec3f& point) {
+        for (std::size_t i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], point[i]);
+            max[i] = std::max(max[i], point[i]);
+        }
+    }
+
+    void add(const Bounds3f& other) {
+        add(other.min);
+        add(other.max);
+    }
+
+    static Bounds3f of(std::span<const Vec3f> points) {
+        Bounds3f bounds{};
+        for (const auto& point : points) {
+            bounds.add(point);
+        }
+        return bounds;
+    }
+};
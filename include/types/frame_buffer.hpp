@@ -1,63 +1,144 @@
 #pragma once
 
 #include "types/color.hpp"
+#include "types/rect.hpp"
 #include "types/vec.hpp"
 #include "utils/colors.hpp" // For default color
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <vector>
 
 // A simple ref counted frame buffer
 class FrameBuffer {
 public:
-    // (0, 0) is the top-left corner
-    FrameBuffer(int width, int height, const Color3& color = Colors::black);
+    // How pixels are stored. Colors are always read and written as Color3 - they are converted on every access
+    enum class Format {
+        RGB32F,     // 3 x 32-bit float, 12 bytes per pixel
+        RGBA8_SRGB, // 4 x 8-bit, sRGB encoded, 4 bytes per pixel
+        RGB10A2,    // 3 x 10-bit + 2-bit alpha, linear, 4 bytes per pixel
+        RGBA16F,    // 4 x 16-bit half float, 8 bytes per pixel
+    };
 
-    // Const accessor
-    const Color3& operator[](const Vec2i& pixel) const {
-        if (pixel.x() < 0 || pixel.x() >= m_width || pixel.y() < 0 || pixel.y() >= m_height) {
-            throw std::runtime_error("Requested coordinates to access were outside of the FrameBuffer: (" +
-                                     std::to_string(pixel.x()) + ", " + std::to_string(pixel.y()) + ")");
+    // A color that has already been converted to the storage format, so it can cheaply be stored to many pixels
+    struct PackedColor {
+        std::array<std::byte, 12> bytes{};
+    };
+
+    // Stands in for a Color3& to a pixel - assigning to it and reading from it go through the storage format. Like a
+    // reference, assigning one pixel to another copies the color rather than rebinding. Pixels may not be stored as
+    // floats, so a Color3& can't be bound to one, and the channels can be read but not written one at a time
+    class PixelRef {
+    public:
+        PixelRef(const FrameBuffer& frame_buffer, std::byte* pixel) : m_frame_buffer{frame_buffer}, m_pixel{pixel} {}
+        PixelRef(const PixelRef&) = default;
+
+        PixelRef& operator=(const Color3& color) {
+            m_frame_buffer.store(m_pixel, m_frame_buffer.pack(color));
+            return *this;
         }
+        PixelRef& operator=(const PixelRef& other) { return *this = static_cast<Color3>(other); }
 
-        // Convert the 2D index to a 1D index for the underlying vector
-        int index = pixel.y() * m_width + pixel.x();
-        return (*m_buffer_ptr)[index];
-    }
+        PixelRef& operator+=(const Color3& color) { return *this = *this + color; }
+        PixelRef& operator-=(const Color3& color) { return *this = *this - color; }
+        PixelRef& operator*=(float scalar) { return *this = *this * scalar; }
+        PixelRef& operator/=(float scalar) { return *this = *this / scalar; }
+
+        operator Color3() const { return m_frame_buffer.unpack(m_pixel); }
+
+        // Read-only access to the channels, and the arithmetic of Color3 - each reads the whole pixel
+        float r() const { return Color3{*this}.r(); }
+        float g() const { return Color3{*this}.g(); }
+        float b() const { return Color3{*this}.b(); }
+        Color3 operator+(const Color3& color) const { return Color3{Color3{*this} + color}; }
+        Color3 operator-(const Color3& color) const { return Color3{Color3{*this} - color}; }
+        Color3 operator*(float scalar) const { return Color3{Color3{*this} * scalar}; }
+        Color3 operator/(float scalar) const { return Color3{Color3{*this} / scalar}; }
+        bool operator==(const Color3& color) const { return Color3{*this} == color; }
+
+    private:
+        const FrameBuffer& m_frame_buffer;
+        std::byte* m_pixel;
+    };
+
+    // (0, 0) is the top-left corner
+    FrameBuffer(int width, int height, const Color3& color = Colors::black, Format format = Format::RGB32F);
+
+    // Const accessor
+    Color3 operator[](const Vec2i& pixel) const { return unpack(checked_pixel(pixel.x(), pixel.y())); }
 
     // Non-const accessor
-    Color3& operator[](const Vec2i& pixel) {
-        if (pixel.x() < 0 || pixel.x() >= m_width || pixel.y() < 0 || pixel.y() >= m_height) {
-            throw std::runtime_error("Requested coordinates to access were outside of the FrameBuffer: (" +
-                                     std::to_string(pixel.x()) + ", " + std::to_string(pixel.y()) + ")");
-        }
-        // Convert the 2D index to a 1D index for the underlying vector
-        int index = pixel.y() * m_width + pixel.x();
-        return (*m_buffer_ptr)[index];
-    }
+    PixelRef operator[](const Vec2i& pixel) { return {*this, checked_pixel(pixel.x(), pixel.y())}; }
 
-    Color3& operator[](int x, int y) const {
-        if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
-            throw std::runtime_error("Requested coordinates to access were outside of the FrameBuffer: (" +
-                                     std::to_string(x) + ", " + std::to_string(y) + ")");
-        }
-        // Convert the 2D index to a 1D index for the underlying vector
-        int index = y * m_width + x;
-        return (*m_buffer_ptr)[index];
-    }
+    Color3 operator[](int x, int y) const { return unpack(checked_pixel(x, y)); }
+    PixelRef operator[](int x, int y) { return {*this, checked_pixel(x, y)}; }
+
+    PackedColor pack(const Color3& color) const;
+    Color3 unpack(const std::byte* pixel) const;
+
+    // Unchecked store of a packed color - for hot loops that have already clipped to the buffer
+    void store(int x, int y, const PackedColor& color) { store(pixel_at(x, y), color); }
+
+    // Sets every pixel to `color`
+    void clear(const Color3& color = Colors::black);
+    // Sets the pixels in `region` to `color`
+    void clear(const Rect2i& region, const Color3& color = Colors::black);
 
     // Explicitly produces a clone of the buffer
     [[nodiscard]] FrameBuffer clone() const;
 
-    // Writes the frame buffer to a file
-    void write(const std::string& filename);
+    // A gamma corrected 8-bit RGB copy of the image, for exporting - the frame buffer itself is left as it is
+    std::vector<std::uint8_t> to_rgb8() const;
+
+    // The image as 8-bit YUV 4:2:0 video (BT.601, limited range), converted from the same gamma corrected colors as
+    // to_rgb8. The full size Y plane is followed by the U and V planes, which are half the size in each direction
+    // (rounded up) and hold the average of each 2x2 block of pixels
+    std::vector<std::uint8_t> to_yuv420() const;
+
+    // Writes the frame buffer to a file, picking the format from the extension: .png, .ppm or .qoi
+    void write(const std::string& filename) const;
 
     inline int width() const { return m_width; }
     inline int height() const { return m_height; }
     inline Vec2i size() const { return Vec2i({m_width, m_height}); }
+    inline Format format() const { return m_format; }
+    inline std::size_t bytes_per_pixel() const { return m_bytes_per_pixel; }
 
 private:
     int m_width{0};
     int m_height{0};
+    Format m_format{Format::RGB32F};
+    std::size_t m_bytes_per_pixel{0};
     // This buffering being shared means that copies of a FrameBuffer will share ownership of image data
-    std::shared_ptr<std::vector<Color3>> m_buffer_ptr{nullptr};
-};
\ No newline at end of file
+    std::shared_ptr<std::vector<std::byte>> m_buffer_ptr{nullptr};
+
+    std::byte* pixel_at(int x, int y) const {
+        // Convert the 2D index to a 1D index for the underlying vector
+        std::size_t index = static_cast<std::size_t>(y) * m_width + x;
+        return m_buffer_ptr->data() + index * m_bytes_per_pixel;
+    }
+
+    std::byte* checked_pixel(int x, int y) const {
+        if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+            throw std::runtime_error("Requested coordinates to access were outside of the FrameBuffer: (" +
+                                     std::to_string(x) + ", " + std::to_string(y) + ")");
+        }
+        return pixel_at(x, y);
+    }
+
+    // Gamma corrects row `y` into 8-bit RGB
+    void row_to_rgb8(int y, std::uint8_t* out) const;
+
+    void store(std::byte* pixel, const PackedColor& color) const {
+        // Fixed size copies, so they compile down to plain stores
+        switch (m_bytes_per_pixel) {
+            case 4: std::memcpy(pixel, color.bytes.data(), 4); break;
+            case 8: std::memcpy(pixel, color.bytes.data(), 8); break;
+            default: std::memcpy(pixel, color.bytes.data(), 12); break;
+        }
+    }
+};
@@ -40,6 +40,8 @@ public:
     }
 
     // Operators
+    constexpr bool operator==(const Matrix& other) const = default;
+
     template <std::size_t OtherRows, std::size_t OtherCols>
     constexpr Matrix<T, Rows, OtherCols> operator*(const Matrix<T, OtherRows, OtherCols>& other) const
         requires(Cols == OtherRows)
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+// The layout of a binary mesh file (.rrmesh). It is meant to be memory-mapped and used in place, so the arrays are
+// stored exactly as Object keeps them in memory, in the native byte order. That makes the files machine-local caches
+// rather than an interchange format:
+//
+//   MeshFileHeader
+//   Vec3f vertices[vertex_count]        at vertex_offset
+//   std::array<int, 3> faces[face_count] at face_offset
+//
+// Both offsets are multiples of `mesh_file_alignment` from the start of the file
+struct MeshFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+
+    // The size and modification time of the file the mesh was converted from - a cache is stale once they change
+    std::uint64_t source_size;
+    std::int64_t source_mtime;
+
+    std::uint64_t vertex_count;
+    std::uint64_t vertex_offset;
+    std::uint64_t face_count;
+    std::uint64_t face_offset;
+
+    // Only valid with `mesh_file_has_bounds` set
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+inline constexpr char mesh_file_magic[8] = {'R', 'R', 'M', 'E', 'S', 'H', '\0', '\0'};
+// Bump whenever the layout changes, so that old caches get rebuilt instead of misread
+inline constexpr std::uint32_t mesh_file_version = 1;
+inline constexpr std::uint32_t mesh_file_alignment = 64;
+inline constexpr std::uint32_t mesh_file_has_bounds = 1u << 0;
+
+inline constexpr const char* mesh_file_extension = ".rrmesh";
+
+// The layout of a chunked mesh file (.rrchunks), for meshes too large to keep in memory all at once. The faces are
+// split into chunks that each carry a copy of the vertices they use, so that every chunk can be read and drawn alone.
+// Like .rrmesh files, they are stored in the native layout and byte order:
+//
+//   ChunkedMeshFileHeader
+//   for every chunk, at its offset:
+//     Vec3f vertices[vertex_count]
+//     std::array<int, 3> faces[face_count]  - indexes into the chunk's own vertices
+//   ChunkRecord chunks[chunk_count]         at chunk_table_offset
+//
+// All offsets are multiples of `mesh_file_alignment` from the start of the file, and the chunks are in the order that
+// their faces were in in the source mesh
+struct ChunkedMeshFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+
+    // The size and modification time of the file the mesh was converted from, like in MeshFileHeader
+    std::uint64_t source_size;
+    std::int64_t source_mtime;
+
+    std::uint64_t chunk_count;
+    std::uint64_t chunk_table_offset;
+    std::uint64_t vertex_count; // Over all of the chunks, so vertices that are shared between chunks count once each
+    std::uint64_t face_count;
+
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+struct ChunkRecord {
+    std::uint64_t offset;
+    std::uint64_t vertex_count;
+    std::uint64_t face_count;
+
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+inline constexpr char chunked_mesh_file_magic[8] = {'R', 'R', 'C', 'H', 'U', 'N', 'K', '\0'};
+inline constexpr std::uint32_t chunked_mesh_file_version = 2;
+
+inline constexpr const char* chunked_mesh_file_extension = ".rrchunks";
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types/object.hpp"
+#include "types/vec.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Everything parsed from one chunk of an OBJ file
+struct ParsedObjChunk {
+    std::vector<Vec3f> vertices{};
+    std::vector<Object::Face> faces{};
+
+    // Face corners (as `face * 3 + corner`) that used a negative index. They were stored relative to the first vertex
+    // of this chunk, as the number of vertices in earlier chunks isn't known until they have all been parsed
+    std::vector<std::size_t> relative_corners{};
+};
+
+// Parses the positions and faces in `text`, which has to be made of whole lines, and appends them to `chunk`. Faces
+// with more than 3 corners are split into triangles. Their indexes are 0-based, but not checked against the vertices
+void parse_obj_chunk(std::string_view text, ParsedObjChunk& chunk, const std::string& filename);
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "types/bounds.hpp"
 #include "types/matrix.hpp"
+#include "types/transform.hpp"
 #include "types/vec.hpp"
+#include "utils/mapped_file.hpp"
 
+#include <memory>
+#include <span>
 #include <vector>
 
 class Object {
@@ -10,19 +15,40 @@ public:
     using Face = std::array<int, 3>;
 
     Object() = default;
+    // Loads a .obj or .rrmesh file - .obj files are converted to a .rrmesh cache next to them on the first load, and
+    // later loads map the cache instead of parsing the text again
     Object(const std::string& filename);
+    // Takes the vertices and faces as they are - the faces have to index into the vertices
+    Object(std::vector<Vec3f> vertices, std::vector<Face> faces);
 
     void load_obj(const std::string& filename);
 
-    const std::vector<Face>& faces() const { return m_faces; }
-    const std::vector<Vec3f>& vertices() const { return m_vertices; }
+    // Maps a binary mesh file and uses its arrays in place, without copying them
+    void load_mesh(const std::string& filename);
+    // Writes the mesh as a binary mesh file - `source` is the file it came from, used to detect stale caches
+    void save_mesh(const std::string& filename, const std::string& source = "") const;
 
-    // TODO: Add ability to transform objects - for now we'll just use the identity matrix
-    const Matrix4x4f transform_matrix() const { return Matrix4x4f::identity(); }
+    std::span<const Face> faces() const { return m_mapping ? m_mapped_faces : std::span<const Face>{m_faces}; }
+    std::span<const Vec3f> vertices() const {
+        return m_mapping ? m_mapped_vertices : std::span<const Vec3f>{m_vertices};
+    }
 
-    // TODO: Impl
+    // The object space bounds of the vertices
+    const Bounds3f& bounds() const { return m_bounds; }
+
+    // Where the object is placed in the world. Every copy of an object has its own transform - copies of one loaded
+    // from a mesh file share the mapping, but otherwise the vertices and faces are copied too. Draw one mesh many times
+    // with Renderer::draw_instanced instead
+    const Transform& transform() const { return m_transform; }
+    void set_transform(const Transform& transform) {
+        m_transform = transform;
+        m_transform_matrix = transform.matrix();
+    }
+    const Matrix4x4f& transform_matrix() const { return m_transform_matrix; }
+
+    // A unit sphere around the origin, split into `slices` around its axis and `stacks` from pole to pole
     static Object sphere(int slices, int stacks);
-    // TODO: Impl
+    // The cube from (-1, -1, -1) to (1, 1, 1)
     static Object cube();
 
     static Object triangle(Vec3f a, Vec3f b, Vec3f c);
@@ -32,4 +58,14 @@ private:
 
     // The indexes of 3 vertices in `m_vertices` that make up a face
     std::vector<Face> m_faces{};
-};
\ No newline at end of file
+
+    Bounds3f m_bounds{};
+
+    Transform m_transform{};
+    Matrix4x4f m_transform_matrix{Matrix4x4f::identity()};
+
+    // Set when the mesh lives in a mapped file instead of the vectors above - shared, so copies stay cheap
+    std::shared_ptr<const MappedFile> m_mapping{nullptr};
+    std::span<const Vec3f> m_mapped_vertices{};
+    std::span<const Face> m_mapped_faces{};
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types/vec.hpp"
+
+#include <algorithm>
+
+// An axis-aligned screen-space rectangle covering the pixels in [min, max)
+struct Rect2i {
+    Vec2i min{0, 0};
+    Vec2i max{0, 0};
+
+    int width() const { return max.x() - min.x(); }
+    int height() const { return max.y() - min.y(); }
+    bool empty() const { return min.x() >= max.x() || min.y() >= max.y(); }
+
+    bool contains(int x, int y) const { return x >= min.x() && x < max.x() && y >= min.y() && y < max.y(); }
+
+    // The overlap of the two rectangles - empty if they don't overlap
+    Rect2i intersect(const Rect2i& other) const {
+        return {Vec2i{std::max(min.x(), other.min.x()), std::max(min.y(), other.min.y())},
+                Vec2i{std::min(max.x(), other.max.x()), std::min(max.y(), other.max.y())}};
+    }
+};
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "types/matrix.hpp"
 #include "types/vec.hpp"
 
+// Places an object in the world - scaled first, then rotated, then moved to `position`
 struct Transform {
-    Vec3f position = std::array{0.f, 0.f, 0.f};
-    Vec3f rotation = std::array{0.f, 0.f, 0.f};
-    Vec3f scale = std::array{1.f, 1.f, 1.f};
-};
\ No newline at end of file
+    Vec3f position{0.f, 0.f, 0.f};
+    // Angles in radians around the x, y and z axes, applied in that order
+    Vec3f rotation{0.f, 0.f, 0.f};
+    Vec3f scale{1.f, 1.f, 1.f};
+
+    // The model matrix that does all of the above - exactly the identity for the default transform
+    Matrix4x4f matrix() const;
+};
@@ -1,15 +1,26 @@
 #pragma once
 
+#include "types/rect.hpp"
+
 #include <algorithm>
+#include <atomic>
 #include <limits>
-#include <mutex>
+#include <thread>
 #include <vector>
 
+// Depth values where larger is closer. Nothing in here needs a lock per pixel - the depth test can be done lock-free
+// with `test_and_write`, and `lock`/`unlock` share a small table of striped spin locks for callers that need to keep
+// other per-pixel data (like the color) in step with the depth.
+// On top of the depths it keeps a conservative depth range for every `cell_size` x `cell_size` cell, so a rasterizer
+// can skip a triangle that is entirely behind what is already drawn, or drop the depth test for one entirely in front
 class ZBuffer {
 public:
+    static constexpr int cell_size = 8;
+
     ZBuffer(int width, int height)
         : m_width(width), m_height(height), m_buffer(width * height, -std::numeric_limits<float>::infinity()),
-          m_mutexes(width * height) {}
+          m_stripes(stripe_count), m_cells_x((width + cell_size - 1) / cell_size),
+          m_cells(m_cells_x * ((height + cell_size - 1) / cell_size)) {}
 
     float& operator[](int x, int y) {
         if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
@@ -20,13 +31,69 @@ public:
         return m_buffer[index];
     }
 
+    // Unchecked access to the first depth value of a row - for hot loops that have already clipped to the buffer.
+    // Depths written through here (or operator[]) have to be recorded with `raise_cell_max`
+    float* row(int y) { return m_buffer.data() + y * m_width; }
+
+    // No depth in the cell is farther than this (by cell coordinates). Depths only ever get closer, so it stays valid
+    // between calls to `update_cells` - it just gets less tight
+    float cell_min(int cell_x, int cell_y) const { return m_cells[cell_y * m_cells_x + cell_x].min; }
+    // No depth in the cell is closer than this
+    float cell_max(int cell_x, int cell_y) const { return m_cells[cell_y * m_cells_x + cell_x].max; }
+
+    // Records that depths up to `z` may have been written to the cell. The caller needs to own the cell
+    void raise_cell_max(int cell_x, int cell_y, float z) {
+        float& max = m_cells[cell_y * m_cells_x + cell_x].max;
+        max = std::max(max, z);
+    }
+
+    // Whether every depth in `pixels` is already at least as close as `z`, going by the depth ranges of the cells
+    bool hides(const Rect2i& pixels, float z) const;
+
+    // Recomputes the exact depth ranges of the cells overlapping `region`. The caller needs to own those cells
+    void update_cells(const Rect2i& region);
+
+    // How many pixels have been written to since the last clear. Only the cells that may have been written to are
+    // looked at, so it's cheap when most of the buffer is still empty
+    std::size_t covered() const;
+
+    // Atomically stores `z` if it is closer than the current depth - returns whether it was stored.
+    // Must not be mixed with unlocked writes through operator[] to the same pixel at the same time
+    bool test_and_write(int x, int y, float z) {
+        if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+            throw std::runtime_error("Requested coordinates to test were outside of the ZBuffer: (" +
+                                     std::to_string(x) + ", " + std::to_string(y) + ")");
+        }
+        std::atomic_ref<float> depth{m_buffer[y * m_width + x]};
+        float current = depth.load(std::memory_order_relaxed);
+        while (z > current) {
+            if (depth.compare_exchange_weak(current, z, std::memory_order_relaxed)) {
+                // The cell's farthest depth is only a lower bound, but its closest must never be too low
+                std::atomic_ref<float> closest{m_cells[(y / cell_size) * m_cells_x + x / cell_size].max};
+                float cell_current = closest.load(std::memory_order_relaxed);
+                while (z > cell_current) {
+                    if (closest.compare_exchange_weak(cell_current, z, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // For callers that need to keep other per-pixel data in step with the depth - the depth test alone is better done
+    // with `test_and_write`. Holds the pixel until `unlock`. Pixels share the locks, so a thread may only hold one pixel
+    // at a time - taking a second one before letting go of the first can deadlock, on itself or with another thread
     void lock(int x, int y) {
         if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
             throw std::runtime_error("Requested coordinates to lock were outside of the ZBuffer: (" +
                                      std::to_string(x) + ", " + std::to_string(y) + ")");
         }
-        int index = y * m_width + x;
-        m_mutexes[index].lock();
+        auto& flag = m_stripes[stripe(x, y)].flag;
+        while (flag.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
     }
 
     void unlock(int x, int y) {
@@ -34,21 +101,47 @@ public:
             throw std::runtime_error("Requested coordinates to unlock were outside of the ZBuffer: (" +
                                      std::to_string(x) + ", " + std::to_string(y) + ")");
         }
-        int index = y * m_width + x;
-        m_mutexes[index].unlock();
+        m_stripes[stripe(x, y)].flag.clear(std::memory_order_release);
+    }
+
+    void clear() {
+        std::fill(m_buffer.begin(), m_buffer.end(), -std::numeric_limits<float>::infinity());
+        std::fill(m_cells.begin(), m_cells.end(), Cell{});
     }
 
-    void clear() { std::fill(m_buffer.begin(), m_buffer.end(), -std::numeric_limits<float>::infinity()); }
+    // Clears the depths in `region`, which has to be made of whole cells (other than where it meets the edge of the
+    // buffer). The caller needs to own those cells
+    void clear(const Rect2i& region);
 
     int width() const { return m_width; }
     int height() const { return m_height; }
     int size() const { return m_width * m_height; }
 
 private:
+    static_assert(std::atomic_ref<float>::is_always_lock_free, "The depth test relies on lock-free float atomics");
+
+    // Independent of the resolution - only one pixel is ever held at a time, so a collision just means waiting
+    static constexpr int stripe_count = 1024;
+
+    // Each lock sits on its own cache line so neighbouring pixels don't fight over the same line
+    struct alignas(64) Stripe {
+        std::atomic_flag flag{};
+    };
+
     int m_width{0};
     int m_height{0};
 
     std::vector<float> m_buffer;
 
-    std::vector<std::mutex> m_mutexes;
+    std::vector<Stripe> m_stripes;
+
+    struct Cell {
+        float min{-std::numeric_limits<float>::infinity()};
+        float max{-std::numeric_limits<float>::infinity()};
+    };
+
+    int m_cells_x{0};
+    std::vector<Cell> m_cells;
+
+    int stripe(int x, int y) const { return (y * m_width + x) % stripe_count; }
 };
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Encoders for 8-bit RGB images, stored row by row with no padding between rows. They throw on I/O errors
+
+// PNG with rows filtered and deflated in parallel bands - it trades some file size for speed, as every band only
+// matches against itself and is coded with the fixed deflate Huffman tables
+void write_png(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb);
+
+// Binary PPM (P6) - just a header and the raw pixels
+void write_ppm(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb);
+
+// QOI - a cheap run-length/delta encoding that is much faster to produce than PNG
+void write_qoi(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb);
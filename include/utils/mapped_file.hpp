@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    const std::byte* data() const { return static_cast<const std::byte*>(m_data); }
+    std::size_t size() const { return m_size; }
+
+    std::string_view text() const { return {static_cast<const char*>(m_data), m_size}; }
+
+private:
+    void* m_data{nullptr};
+    std::size_t m_size{0};
+
+    void unmap();
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <tracy/Tracy.hpp> // Tracy profiling
+
+// How much Tracy instrumentation is compiled in, picked at build time with the `instrumentation` meson option:
+//   0 (off)   - none, and Tracy itself is left disabled
+//   1 (frame) - frame marks, and plots of the renderer's statistics once per frame
+//   2 (stage) - zones around the stages of a draw and around work done a few times per frame, like loading a model
+//   3 (fine)  - zones around work done per object, tile or triangle
+// Helpers that run per pixel or per vertex never get a zone at any level - a zone costs more than they do. What they
+// do shows up in the per-frame counters of RenderStats instead
+#ifndef RASTER_INSTRUMENTATION
+#define RASTER_INSTRUMENTATION 0
+#endif
+
+#if RASTER_INSTRUMENTATION >= 1
+#define PROFILE_FRAME_START(name) FrameMarkStart(name)
+#define PROFILE_FRAME_END(name) FrameMarkEnd(name)
+#define PROFILE_PLOT(name, value) TracyPlot(name, value)
+#else
+#define PROFILE_FRAME_START(name)
+#define PROFILE_FRAME_END(name)
+#define PROFILE_PLOT(name, value)
+#endif
+
+#if RASTER_INSTRUMENTATION >= 2
+#define PROFILE_STAGE(name) ZoneScopedN(name)
+#else
+#define PROFILE_STAGE(name)
+#endif
+
+#if RASTER_INSTRUMENTATION >= 3
+#define PROFILE_FINE(name) ZoneScopedN(name)
+#else
+#define PROFILE_FINE(name)
+#endif
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A pool of persistent worker threads. Every worker owns a deque of tasks - it pops its own work from the back and
+// steals from the front of the other workers' deques once it runs dry
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(std::size_t num_workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The process-wide pool, sized so that the workers plus the calling thread fill the machine
+    static ThreadPool& global();
+
+    std::size_t worker_count() const { return m_workers.size(); }
+
+    // The number of threads that take part in a parallel_for, counting the caller
+    std::size_t concurrency() const { return m_workers.size() + 1; }
+
+    // Which of those threads is calling - the workers are [0, worker_count()), and any other thread is worker_count()
+    std::size_t thread_index() const;
+
+    // Queues an independent task - the future holds its result, or the exception it threw
+    template <typename F> auto submit(F&& func) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(func));
+        std::future<Result> future = task->get_future();
+        push([task]() { (*task)(); });
+        return future;
+    }
+
+    // Waits for a task queued with `submit`, running other queued tasks in the meantime - so a task that waits on
+    // another one can't deadlock the pool by holding the only worker that could run it
+    template <typename T> void wait(const std::future<T>& future) {
+        while (future.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+            if (!try_run_one()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Calls `func(i)` for every i in [start, end), and returns once all of them have finished. The range is handed out
+    // in chunks that start large and shrink as it runs out (never below `min_grain`), so threads that finish early
+    // keep picking up the leftovers instead of idling behind one slow chunk. The caller works on the range too
+    template <typename F> void parallel_for(std::size_t start, std::size_t end, F&& func, std::size_t min_grain = 1);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // The state of one parallel_for - shared with the helper tasks, as they may only get to run after it returns
+    struct LoopState {
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::size_t end{0};
+        std::size_t grain{1};
+        std::size_t participants{1};
+
+        std::mutex error_mutex;
+        std::exception_ptr error{nullptr};
+
+        // Claims the next chunk of the range - returns false once it has all been handed out
+        bool claim(std::size_t& begin, std::size_t& stop);
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues{};
+    std::vector<std::thread> m_workers{};
+
+    std::mutex m_wake_mutex{};
+    std::condition_variable m_wake{};
+    std::size_t m_pending{0}; // Guarded by m_wake_mutex
+    bool m_stopping{false};   // Guarded by m_wake_mutex
+
+    std::atomic<std::size_t> m_next_queue{0};
+
+    void push(Task task);
+
+    // Runs one queued task if there is any, preferring the calling worker's own deque
+    bool try_run_one();
+
+    void worker_loop(std::size_t index);
+
+    // `func` is only dereferenced after claiming a chunk - it may be gone by the time a late helper runs
+    template <typename F> static void run_chunks(LoopState& state, const F* func);
+};
+
+template <typename F> void ThreadPool::run_chunks(LoopState& state, const F* func) {
+    std::size_t begin = 0;
+    std::size_t stop = 0;
+    while (state.claim(begin, stop)) {
+        try {
+            for (std::size_t i = begin; i < stop; ++i) {
+                (*func)(i);
+            }
+        } catch (...) {
+            std::lock_guard lock{state.error_mutex};
+            if (!state.error) {
+                state.error = std::current_exception();
+            }
+        }
+        state.done.fetch_add(stop - begin, std::memory_order_acq_rel);
+    }
+}
+
+template <typename F>
+void ThreadPool::parallel_for(std::size_t start, std::size_t end, F&& func, std::size_t min_grain) {
+    if (start >= end) {
+        return;
+    }
+
+    const std::size_t count = end - start;
+    auto shifted = [&func, start](std::size_t i) { func(start + i); };
+    if (m_workers.empty() || count <= min_grain) {
+        for (std::size_t i = 0; i < count; ++i) {
+            shifted(i);
+        }
+        return;
+    }
+
+    auto state = std::make_shared<LoopState>();
+    state->end = count;
+    state->grain = std::max<std::size_t>(1, min_grain);
+    state->participants = concurrency();
+
+    const std::size_t num_helpers = std::min(m_workers.size(), (count + state->grain - 1) / state->grain - 1);
+    for (std::size_t i = 0; i < num_helpers; ++i) {
+        push([state, body = &shifted]() { run_chunks(*state, body); });
+    }
+
+    run_chunks(*state, &shifted);
+
+    // Other threads may still be finishing their chunks - help out with queued work in the meantime
+    while (state->done.load(std::memory_order_acquire) < count) {
+        if (!try_run_one()) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+
+// Streams 8-bit YUV 4:2:0 frames as YUV4MPEG2 (.y4m) - uncompressed video with a one line header, which encoders like
+// ffmpeg and x264 read straight from a file or a pipe. It throws on I/O errors
+class Y4mWriter {
+public:
+    // A filename of "-" streams to stdout, so nothing else should be written there while the writer is in use
+    Y4mWriter(const std::string& filename, int width, int height, int frames_per_second);
+    ~Y4mWriter();
+
+    Y4mWriter(const Y4mWriter&) = delete;
+    Y4mWriter& operator=(const Y4mWriter&) = delete;
+
+    // `yuv` holds the planes of one frame, laid out like FrameBuffer::to_yuv420 gives them. The frame is flushed out
+    // before returning
+    void write_frame(std::span<const std::uint8_t> yuv);
+
+    // Flushes everything written so far, and then closes the file (but not stdout)
+    void close();
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    std::size_t frame_size() const;
+
+private:
+    std::string m_filename{};
+    std::FILE* m_file{nullptr};
+    bool m_owns_file{false};
+    int m_width{0};
+    int m_height{0};
+
+    void write(const void* data, std::size_t size);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "primitives.hpp"
+#include "types/matrix.hpp"
+#include "types/vec.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// The output of the vertex stage, kept as structure-of-arrays streams so that whole SIMD batches of vertices can be
+// written at once. Meant to be reused between draws so the streams keep their capacity
+struct VertexStreams {
+    void resize(std::size_t count);
+
+    std::size_t size() const { return ndc_z.size(); }
+
+    Vec3f view(std::size_t i) const { return {view_x[i], view_y[i], view_z[i]}; }
+    Vec4f clip(std::size_t i) const { return {clip_x[i], clip_y[i], clip_z[i], clip_w[i]}; }
+    Vec3f ndc(std::size_t i) const { return {ndc_x[i], ndc_y[i], ndc_z[i]}; }
+    ScreenVertex screen(std::size_t i) const { return {{screen_x[i], screen_y[i]}, ndc_z[i]}; }
+
+    std::vector<float> view_x{}, view_y{}, view_z{};
+    std::vector<float> clip_x{}, clip_y{}, clip_z{}, clip_w{};
+    std::vector<float> ndc_x{}, ndc_y{}, ndc_z{};
+    std::vector<std::int32_t> screen_x{}, screen_y{};
+    // The planes of the frustum and the guard band that each vertex is outside of - see ClipCode
+    std::vector<std::int32_t> clip_code{};
+};
+
+// Runs every vertex through the vertex stage in a single SIMD sweep - view space (for lighting), then clip space via
+// the combined model-view-projection matrix, then NDC and finally pixel coordinates. The NDC and pixel coordinates are
+// only meaningful for vertices without clip codes that need clipping. Blocks of vertices are spread over `pool`, or all
+// run on the calling thread when `parallelize` is off
+void run_vertex_stage(std::span<const Vec3f> positions, const Matrix4x4f& model_view, const Matrix4x4f& projection,
+                      int width, int height, VertexStreams& out, ThreadPool& pool = ThreadPool::global(),
+                      bool parallelize = true);
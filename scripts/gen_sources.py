@@ -4,12 +4,15 @@ import glob
 SRC_DIR = 'src'
 OUT_FILE = os.path.join(SRC_DIR, 'meson.build')
 
+# Entry points are added by the executables that own them, so the rest can be shared between targets
+MAIN_FILE = os.path.join(SRC_DIR, 'main.cpp')
+
 def main():
     sources = []
     for ext in ('*.cpp', '*.c', '*.cc'):
         sources.extend(glob.glob(f'{SRC_DIR}/**/{ext}', recursive=True))
 
-    sources = sorted(sources)
+    sources = sorted(s for s in sources if os.path.normpath(s) != MAIN_FILE)
     with open(OUT_FILE, 'w') as f:
         f.write('sources += [\n')
         for s in sources:
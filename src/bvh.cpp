@@ -0,0 +1,66 @@
+#include "bvh.hpp" // self
+#include "utils/profiling.hpp"
+
+#include <algorithm>
+#include <numeric> // std::iota
+
+namespace {
+
+// Empty boxes (like the bounds of an object without any vertices) all sit at the origin
+Vec3f centre(const Bounds3f& bounds) { return bounds.empty() ? Vec3f{} : (bounds.min + bounds.max) * 0.5f; }
+
+} // namespace
+
+Bvh::Bvh(std::span<const Bounds3f> item_bounds, std::size_t leaf_size) {
+    PROFILE_STAGE("Bvh::Bvh"); // Add Tracy profiling for this function
+
+    if (item_bounds.empty()) {
+        return;
+    }
+    leaf_size = std::max<std::size_t>(leaf_size, 1);
+
+    m_items.resize(item_bounds.size());
+    std::iota(m_items.begin(), m_items.end(), 0);
+
+    // A binary tree with n leaves has 2n - 1 nodes
+    m_nodes.reserve(2 * ((item_bounds.size() + leaf_size - 1) / leaf_size));
+    m_nodes.push_back({Bounds3f{}, 0, static_cast<std::uint32_t>(item_bounds.size())});
+
+    // Split breadth first - each split appends both children, so siblings are always next to each other
+    for (std::size_t index = 0; index < m_nodes.size(); ++index) {
+        const std::uint32_t first = m_nodes[index].first;
+        const std::uint32_t count = m_nodes[index].count;
+        const auto items = std::span{m_items}.subspan(first, count);
+
+        Bounds3f bounds{};
+        Bounds3f centres{};
+        for (const std::uint32_t item : items) {
+            if (!item_bounds[item].empty()) {
+                bounds.add(item_bounds[item]);
+            }
+            centres.add(centre(item_bounds[item]));
+        }
+        m_nodes[index].bounds = bounds;
+
+        if (count <= leaf_size) {
+            continue;
+        }
+
+        // Split at the median along the axis that the centres are most spread out on
+        const Vec3f extent = centres.max - centres.min;
+        std::size_t axis = extent.y() > extent.x() ? 1 : 0;
+        if (extent.z() > extent[axis]) {
+            axis = 2;
+        }
+        const std::uint32_t half = count / 2;
+        std::nth_element(items.begin(), items.begin() + half, items.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return centre(item_bounds[a])[axis] < centre(item_bounds[b])[axis];
+        });
+
+        const auto children = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.push_back({Bounds3f{}, first, half});
+        m_nodes.push_back({Bounds3f{}, first + half, count - half});
+        m_nodes[index].first = children;
+        m_nodes[index].count = 0;
+    }
+}
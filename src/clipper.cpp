@@ -0,0 +1,124 @@
+#include "clipper.hpp" // self
+#include "utils/profiling.hpp"
+
+#include <bit> // std::countr_zero, std::popcount
+
+namespace {
+
+// One plane per clip code bit, in bit order - a point p is inside of a plane when dot(plane, p) >= 0
+std::array<Vec4f, 10> planes(const Vec2f& guard_band) {
+    return {
+        Vec4f{1.f, 0.f, 0.f, 1.f},
+        Vec4f{-1.f, 0.f, 0.f, 1.f},
+        Vec4f{0.f, 1.f, 0.f, 1.f},
+        Vec4f{0.f, -1.f, 0.f, 1.f},
+        Vec4f{0.f, 0.f, -1.f, 1.f},
+        Vec4f{0.f, 0.f, 1.f, 1.f},
+        Vec4f{1.f, 0.f, 0.f, guard_band.x()},
+        Vec4f{-1.f, 0.f, 0.f, guard_band.x()},
+        Vec4f{0.f, 1.f, 0.f, guard_band.y()},
+        Vec4f{0.f, -1.f, 0.f, guard_band.y()},
+    };
+}
+
+Vec4f transform_point(const Matrix4x4f& matrix, const Vec3f& point) {
+    const Vec4f homogeneous{point.x(), point.y(), point.z(), 1.f};
+    return {matrix.row(0).dot(homogeneous), matrix.row(1).dot(homogeneous), matrix.row(2).dot(homogeneous),
+            matrix.row(3).dot(homogeneous)};
+}
+
+// Clipping can add at most one vertex per plane
+constexpr std::size_t max_polygon = 3 + std::popcount(static_cast<std::uint32_t>(ClipCode::needs_clipping));
+
+} // namespace
+
+Vec2f guard_band(int width, int height) {
+    return {1.f + 2.f * guard_band_pixels / static_cast<float>(width),
+            1.f + 2.f * guard_band_pixels / static_cast<float>(height)};
+}
+
+std::int32_t clip_code(const Vec4f& clip, const Vec2f& guard_band) {
+    std::int32_t code = 0;
+    const auto all_planes = planes(guard_band);
+    for (std::size_t i = 0; i < all_planes.size(); ++i) {
+        if (all_planes[i].dot(clip) < 0.f) {
+            code |= 1 << i;
+        }
+    }
+    return code;
+}
+
+bool outside_frustum(const Bounds3f& bounds, const Matrix4x4f& mvp) {
+    PROFILE_FINE("outside_frustum"); // Add Tracy profiling for this function
+
+    if (bounds.empty()) {
+        return true;
+    }
+
+    // The box is outside if all 8 of its corners are outside of the same plane
+    std::int32_t common = ClipCode::frustum;
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec3f point{corner & 1 ? bounds.max.x() : bounds.min.x(), corner & 2 ? bounds.max.y() : bounds.min.y(),
+                          corner & 4 ? bounds.max.z() : bounds.min.z()};
+        common &= clip_code(transform_point(mvp, point), Vec2f{1.f, 1.f});
+    }
+    return common != 0;
+}
+
+void clip_triangle(const std::array<Vec4f, 3>& triangle, std::int32_t codes, const Vec2f& guard_band, int width,
+                   int height, std::uint32_t face, std::vector<ClippedTriangle>& out) {
+    PROFILE_FINE("clip_triangle"); // Add Tracy profiling for this function
+
+    std::array<Vec4f, max_polygon> polygon{triangle[0], triangle[1], triangle[2]};
+    std::array<Vec4f, max_polygon> clipped{};
+    std::size_t count = 3;
+
+    // Sutherland-Hodgman - cut the polygon down by one plane at a time. The near and far planes come first in bit
+    // order, so everything is in front of the camera by the time the guard band is clipped against
+    const auto all_planes = planes(guard_band);
+    for (std::int32_t bits = codes & ClipCode::needs_clipping; bits != 0 && count > 0; bits &= bits - 1) {
+        const Vec4f& plane = all_planes[std::countr_zero(static_cast<std::uint32_t>(bits))];
+
+        std::size_t clipped_count = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            const Vec4f& from = polygon[i];
+            const Vec4f& to = polygon[(i + 1) % count];
+            const float from_distance = plane.dot(from);
+            const float to_distance = plane.dot(to);
+
+            if (from_distance >= 0.f) {
+                clipped[clipped_count++] = from;
+            }
+            if ((from_distance >= 0.f) != (to_distance >= 0.f)) {
+                // Always interpolate from the inside point, so the triangles on both sides of an edge split it at
+                // exactly the same point and no cracks open up between them
+                const bool from_inside = from_distance >= 0.f;
+                const Vec4f& inside = from_inside ? from : to;
+                const Vec4f& outside = from_inside ? to : from;
+                const float inside_distance = from_inside ? from_distance : to_distance;
+                const float outside_distance = from_inside ? to_distance : from_distance;
+                const float t = inside_distance / (inside_distance - outside_distance);
+                clipped[clipped_count++] = inside + (outside - inside) * t;
+            }
+        }
+
+        polygon = clipped;
+        count = clipped_count;
+    }
+
+    if (count < 3) {
+        return;
+    }
+
+    // Project what is left and split it into a fan of triangles
+    std::array<Vec3f, max_polygon> ndc{};
+    std::array<ScreenVertex, max_polygon> screen{};
+    for (std::size_t i = 0; i < count; ++i) {
+        const Vec4f& point = polygon[i];
+        ndc[i] = Vec3f{point.x() / point.w(), point.y() / point.w(), point.z() / point.w()};
+        screen[i] = {to_screen_space(ndc[i], width, height), ndc[i].z()};
+    }
+    for (std::size_t i = 1; i + 1 < count; ++i) {
+        out.push_back({{ndc[0], ndc[i], ndc[i + 1]}, {screen[0], screen[i], screen[i + 1]}, face});
+    }
+}
@@ -1,35 +1,72 @@
 #include <iostream>
 
 #include "camera.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_stream.hpp"
 #include "renderer.hpp"
+#include "sequence.hpp"
 #include "types/frame_buffer.hpp"
+#include "types/mesh_file.hpp"
 #include "types/object.hpp"
 
 #include <tracy/Tracy.hpp>
 
+#include <filesystem>
+#include <string>
+#include <string_view>
+
 FrameBuffer some_triangles();
 FrameBuffer some_filled_triangles();
 FrameBuffer body_model(Renderer::Mode mode = Renderer::Mode::Normals);
 FrameBuffer diablo_model(Renderer::Mode mode = Renderer::Mode::Normals);
 FrameBuffer other(const std::string& name, Renderer::Mode mode = Renderer::Mode::Normals);
+void diablo_turntable(int frame_count, const std::string& output, Renderer::Mode mode = Renderer::Mode::Normals);
+FrameBuffer streamed(const std::string& name, Renderer::Mode mode = Renderer::Mode::Normals);
+void optimize_mesh(const std::string& name);
 
 int main(int argc, char* argv[]) {
     int return_code = 0;
 
+    // `raster-rise --turntable [frames] [output]` renders a sequence instead of a single image - to numbered images,
+    // or to a Y4M video when the output ends in .y4m or is "-" for stdout
+    const bool turntable = argc > 1 && std::string_view{argv[1]} == "--turntable";
+    const std::string output = turntable && argc > 3 ? argv[3] : "frames/frame_%04d.png";
+    // `raster-rise --stream <mesh>` draws a mesh a chunk at a time from a chunked mesh file, converting it first if
+    // it isn't one yet
+    const bool stream = argc > 2 && std::string_view{argv[1]} == "--stream";
+    // `raster-rise --optimize <mesh>` reorders a mesh for locality, and writes it to the mesh cache that later loads of
+    // it map - or back to the mesh itself when it is a .rrmesh file
+    const bool optimize = argc > 2 && std::string_view{argv[1]} == "--optimize";
+
+    // Keep stdout clean for the video
+    std::streambuf* const stdout_buffer = std::cout.rdbuf();
+    if (output == "-") {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
     std::cout << "[ -- Starting raster-rise -- ]\n" << std::endl;
 
     try {
         [[maybe_unused]] constexpr Renderer::Mode mode = Renderer::Mode::Normals;
 
-        FrameBuffer frame_buffer{some_triangles()};
-
-        frame_buffer.write("output.png");
+        if (turntable) {
+            diablo_turntable(argc > 2 ? std::stoi(argv[2]) : 120, output, mode);
+        } else if (stream) {
+            streamed(argv[2], mode).write("output.png");
+        } else if (optimize) {
+            optimize_mesh(argv[2]);
+        } else {
+            FrameBuffer frame_buffer{some_triangles()};
+
+            frame_buffer.write("output.png");
+        }
     } catch (const std::exception& e) {
         std::cerr << "[ERROR] " << e.what() << std::endl;
         return_code = 1;
     }
 
     std::cout << "\n[ -- Stopping raster-rise -- ]" << std::endl;
+    std::cout.rdbuf(stdout_buffer);
 
     return return_code;
 }
@@ -91,3 +128,51 @@ FrameBuffer other(const std::string& name, Renderer::Mode mode) {
 
     return frame_buffer;
 }
+
+FrameBuffer streamed(const std::string& name, Renderer::Mode mode) {
+    FrameBuffer frame_buffer{1500, 1500};
+    Camera camera{};
+    camera.set_position({0.f, 0.f, -4.f});
+
+    std::string chunked = name;
+    if (!name.ends_with(chunked_mesh_file_extension)) {
+        chunked = name + chunked_mesh_file_extension;
+        if (!MeshStream::is_fresh(chunked, name)) {
+            MeshStream::convert(name, chunked);
+        }
+    }
+    MeshStream model{chunked};
+    Renderer::draw(model, camera, frame_buffer, PipelineState{.mode = mode});
+
+    return frame_buffer;
+}
+
+void optimize_mesh(const std::string& name) {
+    const Object model{name};
+    const Object optimized = MeshOptimizer::optimize(model);
+    std::cout << "Vertices: " << model.vertices().size() << " -> " << optimized.vertices().size() << "\n"
+              << "Cache misses per face: " << MeshOptimizer::cache_miss_ratio(model.faces(), model.vertices().size())
+              << " -> " << MeshOptimizer::cache_miss_ratio(optimized.faces(), optimized.vertices().size())
+              << std::endl;
+
+    // Stamped with the source like any other cache, so that it is only used until the source changes
+    if (name.ends_with(mesh_file_extension)) {
+        const std::string source = name.substr(0, name.size() - std::string_view{mesh_file_extension}.size());
+        optimized.save_mesh(name, std::filesystem::exists(source) ? source : "");
+    } else {
+        optimized.save_mesh(name + mesh_file_extension, name);
+    }
+}
+
+void diablo_turntable(int frame_count, const std::string& output, Renderer::Mode mode) {
+    Sequence::Settings settings{};
+    settings.frame_count = frame_count;
+    settings.state.mode = mode;
+
+    const bool video = output == "-" || output.ends_with(".y4m");
+    Sequence::Sink sink = video ? Sequence::video_stream(output, settings.width, settings.height)
+                                : Sequence::image_files(output);
+
+    Object model{"objects/diablo3_post.obj"};
+    Sequence::render({model}, Camera{}, settings, Sequence::turntable({0.f, 0.f, 0.f}, 4.f, 0.f, frame_count), sink);
+}
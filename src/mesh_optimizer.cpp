@@ -0,0 +1,251 @@
+#include "mesh_optimizer.hpp" // self
+#include "utils/profiling.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+constexpr std::uint32_t unused = std::numeric_limits<std::uint32_t>::max();
+
+// The bits of a position, with -0 and 0 made the same
+struct PositionKey {
+    std::uint32_t x, y, z;
+
+    explicit PositionKey(const Vec3f& position)
+        : x{std::bit_cast<std::uint32_t>(position.x() + 0.f)}, y{std::bit_cast<std::uint32_t>(position.y() + 0.f)},
+          z{std::bit_cast<std::uint32_t>(position.z() + 0.f)} {}
+
+    bool operator==(const PositionKey&) const = default;
+};
+
+struct PositionHash {
+    std::size_t operator()(const PositionKey& key) const {
+        std::uint64_t hash = key.x;
+        hash = hash * 0x9e3779b97f4a7c15ull ^ key.y;
+        hash = hash * 0x9e3779b97f4a7c15ull ^ key.z;
+        return static_cast<std::size_t>(hash ^ (hash >> 32));
+    }
+};
+
+void check_indices(std::span<const Object::Face> faces, std::size_t vertex_count) {
+    for (const Object::Face& face : faces) {
+        for (const int index : face) {
+            if (index < 0 || static_cast<std::size_t>(index) >= vertex_count) {
+                throw std::invalid_argument("Face references a vertex that doesn't exist: " + std::to_string(index));
+            }
+        }
+    }
+}
+
+// Points every face index at `remap[index]`, and moves each vertex that is still used to its new index. Where several
+// vertices move to the same index, the first of them is kept
+void remap_vertices(std::vector<Vec3f>& vertices, std::vector<Object::Face>& faces,
+                    const std::vector<std::uint32_t>& remap, std::size_t new_count) {
+    std::vector<Vec3f> remapped(new_count);
+    for (std::size_t i = vertices.size(); i-- > 0;) {
+        if (remap[i] != unused) {
+            remapped[remap[i]] = vertices[i];
+        }
+    }
+    for (Object::Face& face : faces) {
+        for (int& index : face) {
+            index = static_cast<int>(remap[static_cast<std::size_t>(index)]);
+        }
+    }
+    vertices = std::move(remapped);
+}
+
+} // namespace
+
+std::size_t MeshOptimizer::weld_vertices(std::vector<Vec3f>& vertices, std::vector<Object::Face>& faces) {
+    PROFILE_STAGE("MeshOptimizer::weld_vertices"); // Add Tracy profiling for this function
+
+    check_indices(faces, vertices.size());
+
+    std::unordered_map<PositionKey, std::uint32_t, PositionHash> first_at{};
+    first_at.reserve(vertices.size());
+    std::vector<std::uint32_t> remap(vertices.size());
+    std::uint32_t kept = 0;
+    for (std::size_t i = 0; i < vertices.size(); ++i) {
+        const auto [entry, inserted] = first_at.try_emplace(PositionKey{vertices[i]}, kept);
+        remap[i] = entry->second;
+        if (inserted) {
+            ++kept;
+        }
+    }
+
+    // Welded vertices take the index of the first of them, so the rest stay in the same order
+    const std::size_t dropped = vertices.size() - kept;
+    if (dropped > 0) {
+        remap_vertices(vertices, faces, remap, kept);
+    }
+    return dropped;
+}
+
+void MeshOptimizer::optimize_face_order(std::vector<Object::Face>& faces, std::size_t vertex_count,
+                                        std::size_t cache_size) {
+    PROFILE_STAGE("MeshOptimizer::optimize_face_order"); // Add Tracy profiling for this function
+
+    check_indices(faces, vertex_count);
+    if (faces.empty()) {
+        return;
+    }
+
+    // The faces around every vertex, as ranges of `adjacent`
+    std::vector<std::uint32_t> live(vertex_count, 0);
+    for (const Object::Face& face : faces) {
+        for (const int index : face) {
+            ++live[static_cast<std::size_t>(index)];
+        }
+    }
+    std::vector<std::size_t> first_adjacent(vertex_count + 1, 0);
+    for (std::size_t v = 0; v < vertex_count; ++v) {
+        first_adjacent[v + 1] = first_adjacent[v] + live[v];
+    }
+    std::vector<std::uint32_t> adjacent(first_adjacent[vertex_count]);
+    {
+        std::vector<std::size_t> fill(first_adjacent.begin(), first_adjacent.end() - 1);
+        for (std::size_t f = 0; f < faces.size(); ++f) {
+            for (const int index : faces[f]) {
+                adjacent[fill[static_cast<std::size_t>(index)]++] = static_cast<std::uint32_t>(f);
+            }
+        }
+    }
+
+    // When each vertex last went into the cache - it is still there while less than `cache_size` newer ones went in
+    const auto cache = static_cast<std::uint64_t>(std::max<std::size_t>(cache_size, 3));
+    std::vector<std::uint64_t> cached_at(vertex_count, 0);
+    std::uint64_t time = cache + 1;
+    auto in_cache = [&](std::size_t v) { return time - cached_at[v] <= cache; };
+
+    std::vector<Object::Face> ordered{};
+    ordered.reserve(faces.size());
+    std::vector<std::uint8_t> emitted(faces.size(), 0);
+    std::vector<std::uint32_t> dead_ends{}; // Recently used vertices to go back to when a fan runs out
+    std::vector<std::uint32_t> candidates{};
+    std::size_t next_unvisited = 0;
+
+    // Fan out from one vertex at a time, drawing all of the faces around it that haven't been drawn yet
+    std::size_t fan = 0;
+    while (true) {
+        candidates.clear();
+        for (std::size_t a = first_adjacent[fan]; a < first_adjacent[fan + 1]; ++a) {
+            const std::uint32_t f = adjacent[a];
+            if (emitted[f]) {
+                continue;
+            }
+            emitted[f] = 1;
+            ordered.push_back(faces[f]);
+            for (const int index : faces[f]) {
+                const auto v = static_cast<std::size_t>(index);
+                dead_ends.push_back(static_cast<std::uint32_t>(v));
+                candidates.push_back(static_cast<std::uint32_t>(v));
+                --live[v];
+                if (!in_cache(v)) {
+                    cached_at[v] = time++;
+                }
+            }
+        }
+
+        // Carry on from the vertex of the fan that is still in the cache and will be for its remaining faces, oldest
+        // first - as it would be the next to be pushed out
+        std::size_t best = vertex_count;
+        std::uint64_t best_priority = 0;
+        for (const std::uint32_t v : candidates) {
+            if (live[v] == 0) {
+                continue;
+            }
+            std::uint64_t priority = 0;
+            if (time - cached_at[v] + 2 * static_cast<std::uint64_t>(live[v]) <= cache) {
+                priority = time - cached_at[v];
+            }
+            if (best == vertex_count || priority > best_priority) {
+                best = v;
+                best_priority = priority;
+            }
+        }
+
+        // Otherwise go back to the most recently used vertex with faces left, or on to the next one that has any
+        while (best == vertex_count && !dead_ends.empty()) {
+            const std::uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live[v] > 0) {
+                best = v;
+            }
+        }
+        while (best == vertex_count && next_unvisited < vertex_count) {
+            if (live[next_unvisited] > 0) {
+                best = next_unvisited;
+            }
+            ++next_unvisited;
+        }
+        if (best == vertex_count) {
+            break;
+        }
+        fan = best;
+    }
+
+    faces = std::move(ordered);
+}
+
+void MeshOptimizer::optimize_vertex_order(std::vector<Vec3f>& vertices, std::vector<Object::Face>& faces) {
+    PROFILE_STAGE("MeshOptimizer::optimize_vertex_order"); // Add Tracy profiling for this function
+
+    check_indices(faces, vertices.size());
+
+    std::vector<std::uint32_t> remap(vertices.size(), unused);
+    std::uint32_t next = 0;
+    for (const Object::Face& face : faces) {
+        for (const int index : face) {
+            std::uint32_t& target = remap[static_cast<std::size_t>(index)];
+            if (target == unused) {
+                target = next++;
+            }
+        }
+    }
+    remap_vertices(vertices, faces, remap, next);
+}
+
+float MeshOptimizer::cache_miss_ratio(std::span<const Object::Face> faces, std::size_t vertex_count,
+                                      std::size_t cache_size) {
+    check_indices(faces, vertex_count);
+    if (faces.empty() || cache_size == 0) {
+        return faces.empty() ? 0.f : 3.f;
+    }
+
+    // A vertex is in the cache while fewer than `cache_size` vertices have gone in after it
+    std::vector<std::uint64_t> cached_at(vertex_count, 0);
+    std::uint64_t time = cache_size + 1;
+    std::uint64_t misses = 0;
+    for (const Object::Face& face : faces) {
+        for (const int index : face) {
+            const auto v = static_cast<std::size_t>(index);
+            if (time - cached_at[v] > cache_size) {
+                cached_at[v] = time++;
+                ++misses;
+            }
+        }
+    }
+    return static_cast<float>(misses) / static_cast<float>(faces.size());
+}
+
+Object MeshOptimizer::optimize(const Object& object) {
+    PROFILE_STAGE("MeshOptimizer::optimize"); // Add Tracy profiling for this function
+
+    std::vector<Vec3f> vertices{object.vertices().begin(), object.vertices().end()};
+    std::vector<Object::Face> faces{object.faces().begin(), object.faces().end()};
+
+    weld_vertices(vertices, faces);
+    optimize_face_order(faces, vertices.size());
+    optimize_vertex_order(vertices, faces);
+
+    Object optimized{std::move(vertices), std::move(faces)};
+    optimized.set_transform(object.transform());
+    return optimized;
+}
@@ -0,0 +1,331 @@
+#include "mesh_stream.hpp" // self
+#include "types/mesh_file.hpp"
+#include "types/obj_parser.hpp"
+#include "types/vec.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/profiling.hpp"
+
+#include <unistd.h> // getpid
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+// .obj files are parsed in blocks of about this many bytes
+constexpr std::size_t obj_block_bytes = 16 * 1024 * 1024;
+
+std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + mesh_file_alignment - 1) / mesh_file_alignment * mesh_file_alignment;
+}
+
+// The size and modification time of `source`, as recorded in chunked mesh file headers
+std::pair<std::uint64_t, std::int64_t> source_stamp(const std::string& source) {
+    return {std::filesystem::file_size(source),
+            static_cast<std::int64_t>(std::filesystem::last_write_time(source).time_since_epoch().count())};
+}
+
+template <typename T>
+void write_array(std::ofstream& file, std::span<const T> items) {
+    file.write(reinterpret_cast<const char*>(items.data()), static_cast<std::streamsize>(items.size_bytes()));
+}
+
+void pad_to(std::ofstream& file, std::uint64_t offset) {
+    const std::vector<char> padding(mesh_file_alignment, 0);
+    file.write(padding.data(), static_cast<std::streamsize>(offset - static_cast<std::uint64_t>(file.tellp())));
+}
+
+// Deletes a file when it goes out of scope, so that temporary files don't outlive errors
+struct TemporaryFile {
+    std::string filename;
+
+    ~TemporaryFile() {
+        std::error_code error{};
+        std::filesystem::remove(filename, error);
+    }
+};
+
+// Parses an .obj file a block at a time, appending the vertices and faces to two files of raw arrays. The faces index
+// into all of the vertices of the file
+void split_obj(const std::string& source, const std::string& vertex_file, const std::string& face_file) {
+    PROFILE_STAGE("MeshStream split_obj"); // Add Tracy profiling for this function
+
+    std::ifstream input(source, std::ios::binary);
+    std::ofstream vertices(vertex_file, std::ios::binary | std::ios::trunc);
+    std::ofstream faces(face_file, std::ios::binary | std::ios::trunc);
+    if (!input.is_open()) {
+        throw std::runtime_error("Failed to open file: " + source);
+    }
+    if (!vertices.is_open() || !faces.is_open()) {
+        throw std::runtime_error("Failed to open temporary files next to: " + vertex_file);
+    }
+
+    std::string block{};
+    ParsedObjChunk chunk{};
+    std::size_t vertex_base = 0;
+    while (input) {
+        // Read on to the end of a block, and keep whatever comes after its last whole line for the next one
+        const std::size_t carried = block.size();
+        block.resize(carried + obj_block_bytes);
+        input.read(block.data() + carried, static_cast<std::streamsize>(obj_block_bytes));
+        block.resize(carried + static_cast<std::size_t>(input.gcount()));
+
+        const std::size_t line_break = block.rfind('\n');
+        if (input && line_break == std::string::npos) {
+            continue;
+        }
+        const std::size_t end = input ? line_break + 1 : block.size();
+
+        chunk.vertices.clear();
+        chunk.faces.clear();
+        chunk.relative_corners.clear();
+        parse_obj_chunk(std::string_view{block}.substr(0, end), chunk, source);
+        for (const std::size_t corner : chunk.relative_corners) {
+            chunk.faces[corner / 3][corner % 3] += static_cast<int>(vertex_base);
+        }
+        vertex_base += chunk.vertices.size();
+
+        write_array(vertices, std::span<const Vec3f>{chunk.vertices});
+        write_array(faces, std::span<const Object::Face>{chunk.faces});
+        block.erase(0, end);
+    }
+
+    if (!input.eof() || !vertices || !faces) {
+        throw std::runtime_error("Failed to split " + source + " into temporary files");
+    }
+}
+
+// Writes the faces out in chunks, each with a copy of just the vertices it uses
+void write_chunks(std::span<const Vec3f> vertices, std::span<const Object::Face> faces,
+                  const std::pair<std::uint64_t, std::int64_t>& stamp, const std::string& destination,
+                  std::size_t faces_per_chunk) {
+    PROFILE_STAGE("MeshStream write_chunks"); // Add Tracy profiling for this function
+
+    ChunkedMeshFileHeader header{};
+    std::memcpy(header.magic, chunked_mesh_file_magic, sizeof(chunked_mesh_file_magic));
+    header.version = chunked_mesh_file_version;
+    std::tie(header.source_size, header.source_mtime) = stamp;
+    header.face_count = faces.size();
+
+    // Write to a temporary file first, so that nothing ever reads a half written mesh
+    const std::string temporary = destination + ".tmp." + std::to_string(::getpid());
+    TemporaryFile cleanup{temporary};
+
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file for writing: " + temporary);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<ChunkRecord> records{};
+    std::vector<int> used{};
+    std::vector<Vec3f> chunk_vertices{};
+    std::vector<Object::Face> chunk_faces{};
+    Bounds3f bounds{};
+    for (std::size_t first = 0; first < faces.size(); first += faces_per_chunk) {
+        const auto global_faces = faces.subspan(first, std::min(faces_per_chunk, faces.size() - first));
+
+        // The vertices that the chunk uses, in the order they were in before
+        used.clear();
+        for (const Object::Face& face : global_faces) {
+            for (const int index : face) {
+                if (index < 0 || static_cast<std::size_t>(index) >= vertices.size()) {
+                    throw std::runtime_error("Face references a vertex that doesn't exist in " + destination + ": " +
+                                             std::to_string(index + 1));
+                }
+                used.push_back(index);
+            }
+        }
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+
+        chunk_vertices.clear();
+        for (const int index : used) {
+            chunk_vertices.push_back(vertices[static_cast<std::size_t>(index)]);
+        }
+        chunk_faces.clear();
+        for (const Object::Face& face : global_faces) {
+            Object::Face& local = chunk_faces.emplace_back();
+            for (std::size_t corner = 0; corner < 3; ++corner) {
+                const auto local_index = std::lower_bound(used.begin(), used.end(), face[corner]) - used.begin();
+                local[corner] = static_cast<int>(local_index);
+            }
+        }
+
+        const Bounds3f chunk_bounds = Bounds3f::of(chunk_vertices);
+        ChunkRecord& record = records.emplace_back();
+        record.offset = align_up(static_cast<std::uint64_t>(file.tellp()));
+        record.vertex_count = chunk_vertices.size();
+        record.face_count = chunk_faces.size();
+        for (std::size_t i = 0; i < 3; ++i) {
+            record.bounds_min[i] = chunk_bounds.min[i];
+            record.bounds_max[i] = chunk_bounds.max[i];
+        }
+        bounds.add(chunk_bounds);
+        header.vertex_count += chunk_vertices.size();
+
+        pad_to(file, record.offset);
+        write_array(file, std::span<const Vec3f>{chunk_vertices});
+        write_array(file, std::span<const Object::Face>{chunk_faces});
+    }
+
+    header.chunk_count = records.size();
+    header.chunk_table_offset = align_up(static_cast<std::uint64_t>(file.tellp()));
+    for (std::size_t i = 0; i < 3; ++i) {
+        header.bounds_min[i] = bounds.min[i];
+        header.bounds_max[i] = bounds.max[i];
+    }
+    pad_to(file, header.chunk_table_offset);
+    write_array(file, std::span<const ChunkRecord>{records});
+
+    // Now that the chunks are known, go back and fill in the header
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write chunked mesh file: " + destination);
+    }
+    std::filesystem::rename(temporary, destination);
+
+    std::cout << "Wrote " << header.face_count << " faces in " << header.chunk_count << " chunks to " << destination
+              << std::endl;
+}
+
+} // namespace
+
+void MeshStream::convert(const std::string& source, const std::string& destination, std::size_t faces_per_chunk) {
+    PROFILE_STAGE("MeshStream::convert"); // Add Tracy profiling for this function
+
+    if (faces_per_chunk == 0) {
+        throw std::invalid_argument("Chunks need room for at least one face");
+    }
+
+    const std::filesystem::path path{destination};
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+
+    // Taken before the source is read, so that changes made while it is being converted make the result stale
+    const auto stamp = source_stamp(source);
+
+    if (source.ends_with(mesh_file_extension)) {
+        // Already laid out as arrays - the mapping pages them in and out as the chunks are written
+        const Object mesh{source};
+        write_chunks(mesh.vertices(), mesh.faces(), stamp, destination, faces_per_chunk);
+        return;
+    }
+
+    // Parsed to arrays on disk first, as faces can use vertices from anywhere in the file
+    const std::string stem = destination + ".tmp." + std::to_string(::getpid());
+    const TemporaryFile vertex_file{stem + ".vertices"};
+    const TemporaryFile face_file{stem + ".faces"};
+    split_obj(source, vertex_file.filename, face_file.filename);
+
+    const MappedFile vertices{vertex_file.filename};
+    const MappedFile faces{face_file.filename};
+    write_chunks({reinterpret_cast<const Vec3f*>(vertices.data()), vertices.size() / sizeof(Vec3f)},
+                 {reinterpret_cast<const Object::Face*>(faces.data()), faces.size() / sizeof(Object::Face)},
+                 stamp, destination, faces_per_chunk);
+}
+
+bool MeshStream::is_fresh(const std::string& destination, const std::string& source) {
+    std::ifstream file(destination, std::ios::binary);
+    ChunkedMeshFileHeader header{};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+
+    return std::memcmp(header.magic, chunked_mesh_file_magic, sizeof(chunked_mesh_file_magic)) == 0 &&
+           header.version == chunked_mesh_file_version &&
+           std::pair{header.source_size, header.source_mtime} == source_stamp(source);
+}
+
+MeshStream::MeshStream(const std::string& filename, std::size_t chunks_in_flight)
+    : m_filename{filename}, m_chunks_in_flight{std::max<std::size_t>(chunks_in_flight, 1)} {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    const auto file_size = static_cast<std::uint64_t>(file.tellg());
+    file.seekg(0);
+
+    ChunkedMeshFileHeader header{};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        throw std::runtime_error("Chunked mesh file is too small to be valid: " + filename);
+    }
+    if (std::memcmp(header.magic, chunked_mesh_file_magic, sizeof(chunked_mesh_file_magic)) != 0) {
+        throw std::runtime_error("Not a chunked mesh file: " + filename);
+    }
+    if (header.version != chunked_mesh_file_version) {
+        throw std::runtime_error("Unsupported chunked mesh file version " + std::to_string(header.version) + ": " +
+                                 filename);
+    }
+    if (header.chunk_table_offset > file_size ||
+        header.chunk_count > (file_size - header.chunk_table_offset) / sizeof(ChunkRecord)) {
+        throw std::runtime_error("Chunked mesh file is truncated or corrupt: " + filename);
+    }
+
+    m_chunks.resize(header.chunk_count);
+    file.seekg(static_cast<std::streamoff>(header.chunk_table_offset));
+    file.read(reinterpret_cast<char*>(m_chunks.data()),
+              static_cast<std::streamsize>(m_chunks.size() * sizeof(ChunkRecord)));
+    if (!file) {
+        throw std::runtime_error("Failed to read the chunk table of: " + filename);
+    }
+
+    m_chunk_bounds.reserve(m_chunks.size());
+    for (const ChunkRecord& chunk : m_chunks) {
+        // Compared by what is left of the file after each array, so that huge counts can't wrap around and pass
+        const std::uint64_t left = chunk.offset <= file_size ? file_size - chunk.offset : 0;
+        if (chunk.offset % mesh_file_alignment != 0 || chunk.offset > file_size ||
+            chunk.vertex_count > left / sizeof(Vec3f) ||
+            chunk.face_count > (left - chunk.vertex_count * sizeof(Vec3f)) / sizeof(Object::Face)) {
+            throw std::runtime_error("Chunked mesh file is truncated or corrupt: " + filename);
+        }
+
+        Bounds3f& bounds = m_chunk_bounds.emplace_back();
+        bounds.min = Vec3f{chunk.bounds_min[0], chunk.bounds_min[1], chunk.bounds_min[2]};
+        bounds.max = Vec3f{chunk.bounds_max[0], chunk.bounds_max[1], chunk.bounds_max[2]};
+    }
+
+    m_vertex_count = header.vertex_count;
+    m_face_count = header.face_count;
+    m_bounds.min = Vec3f{header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]};
+    m_bounds.max = Vec3f{header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]};
+}
+
+Object MeshStream::read_chunk(std::size_t index) const {
+    PROFILE_FINE("MeshStream::read_chunk"); // Add Tracy profiling for this function
+
+    const ChunkRecord& chunk = m_chunks.at(index);
+    std::vector<Vec3f> vertices(chunk.vertex_count);
+    std::vector<Object::Face> faces(chunk.face_count);
+
+    // Every read opens the file for itself, so that chunks can be read on several threads at once
+    std::ifstream file(m_filename, std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(chunk.offset));
+    file.read(reinterpret_cast<char*>(vertices.data()), static_cast<std::streamsize>(vertices.size() * sizeof(Vec3f)));
+    file.read(reinterpret_cast<char*>(faces.data()), static_cast<std::streamsize>(faces.size() * sizeof(Object::Face)));
+    if (!file) {
+        throw std::runtime_error("Failed to read chunk " + std::to_string(index) + " of: " + m_filename);
+    }
+
+    // The file could have changed since it was opened, and the renderer trusts the indexes
+    for (const Object::Face& face : faces) {
+        for (const int vertex : face) {
+            if (vertex < 0 || static_cast<std::uint64_t>(vertex) >= chunk.vertex_count) {
+                throw std::runtime_error("Chunk " + std::to_string(index) + " of " + m_filename +
+                                         " references a vertex that doesn't exist: " + std::to_string(vertex));
+            }
+        }
+    }
+
+    return Object{std::move(vertices), std::move(faces)};
+}
@@ -1,37 +1,19 @@
 #include "primitives.hpp" // self
 #include "types/vec.hpp"
+#include "utils/profiling.hpp"
 
-#include <tracy/Tracy.hpp> // Tracy profiling
+#include <xsimd/xsimd.hpp> // SIMD batches
 
 #include <algorithm>  // std::sort
-#include <functional> // For std::hash
+#include <bit>        // std::countr_zero, std::popcount
+#include <cstdint>
 #include <iostream>
-#include <unordered_map>
-
-namespace std {
-template <> struct hash<Vec3f> {
-    size_t operator()(const Vec3f& vec) const {
-        size_t h1 = std::hash<float>{}(vec.x());
-        size_t h2 = std::hash<float>{}(vec.y());
-        size_t h3 = std::hash<float>{}(vec.z());
-        return h1 ^ (h2 << 1) ^ (h3 << 2); // Combine hashes
-    }
-};
-} // namespace std
-namespace {
-
-Vec2i to_screen_space(const Vec3f& ndc, int width, int height) {
-    ZoneScopedN("to_screen_space"); // Add Tracy profiling for this function
+#include <limits>
+#include <numeric> // std::iota
 
-    // Convert to screen space
-    int x = static_cast<int>((-ndc.x() + 1.0f) * 0.5f * width);  // Flip x-axis
-    int y = static_cast<int>((-ndc.y() + 1.0f) * 0.5f * height); // Flip y-axis
-    return {x, y};
-}
+namespace {
 
 std::pair<Vec2i, Vec2i> find_bounding_box(Vec2i a, Vec2i b, Vec2i c) {
-    ZoneScopedN("find_bounding_box"); // Add Tracy profiling for this function
-
     // Find the bounding box of the triangle
     int min_x = std::min({a.x(), b.x(), c.x()});
     int max_x = std::max({a.x(), b.x(), c.x()});
@@ -42,8 +24,6 @@ std::pair<Vec2i, Vec2i> find_bounding_box(Vec2i a, Vec2i b, Vec2i c) {
 }
 
 double signed_triangle_area(Vec2i a, Vec2i b, Vec2i c) {
-    ZoneScopedN("signed_triangle_area"); // Add Tracy profiling for this function
-
     // TODO: Revisit this original formula
     // The shoelace formula
     // return 0.5 *
@@ -52,10 +32,52 @@ double signed_triangle_area(Vec2i a, Vec2i b, Vec2i c) {
     return ((b.y() - c.y()) * (a.x() - c.x()) + (c.x() - b.x()) * (a.y() - c.y()));
 }
 
+Rect2i full_frame(const FrameBuffer& frame_buffer) { return {{0, 0}, frame_buffer.size()}; }
+
+using IntBatch = xsimd::batch<std::int32_t>;
+using FloatBatch = xsimd::batch<float>;
+static_assert(IntBatch::size == FloatBatch::size, "Coverage and depth batches must line up");
+
+// The number of pixels tested per step by the triangle rasterizer
+constexpr int lanes = static_cast<int>(FloatBatch::size);
+
+// An integer edge function w(x, y) = a * x + b * y + c, equal to signed_triangle_area(p, from, to)
+struct EdgeFunction {
+    int a;
+    int b;
+    int c;
+
+    EdgeFunction(const Vec2i& from, const Vec2i& to, int winding)
+        : a((from.y() - to.y()) * winding), b((to.x() - from.x()) * winding), c(-a * to.x() - b * to.y()) {}
+
+    IntBatch at(const IntBatch& x, int y) const { return a * x + (b * y + c); }
+};
+
+// {0, 1, 2, ...} - the x offset of each lane from the start of the batch
+IntBatch lane_indices() {
+    std::array<std::int32_t, lanes> indices{};
+    std::iota(indices.begin(), indices.end(), 0);
+    return IntBatch::load_unaligned(indices.data());
+}
+
 } // namespace
 
+Vec2i to_screen_space(const Vec3f& ndc, int width, int height) {
+    // Convert to screen space
+    int x = static_cast<int>((-ndc.x() + 1.0f) * 0.5f * width);  // Flip x-axis
+    int y = static_cast<int>((-ndc.y() + 1.0f) * 0.5f * height); // Flip y-axis
+    return {x, y};
+}
+
 void draw_line(Vec3f a, Vec3f b, FrameBuffer& frame_buffer, const Color3& color) {
-    ZoneScopedN("draw_line"); // Add Tracy profiling for this function
+    draw_line(a, b, frame_buffer, color, full_frame(frame_buffer));
+}
+
+void draw_line(Vec3f a, Vec3f b, FrameBuffer& frame_buffer, const Color3& color, const Rect2i& clip) {
+    PROFILE_FINE("draw_line"); // Add Tracy profiling for this function
+
+    const Rect2i bounds = clip.intersect(full_frame(frame_buffer));
+    const FrameBuffer::PackedColor packed = frame_buffer.pack(color);
 
     // Convert to screen space
     Vec3i a_screen = to_screen_space(a, frame_buffer.width(), frame_buffer.height());
@@ -72,90 +94,218 @@ void draw_line(Vec3f a, Vec3f b, FrameBuffer& frame_buffer, const Color3& color)
         std::swap(a_screen.y(), b_screen.y());
     }
 
-    for (int x = a_screen.x(); x <= b_screen.x(); ++x) {
+    // Only step along the part of the major axis that can land inside of the clip region
+    const int first_x = std::max(a_screen.x(), transpose ? bounds.min.y() : bounds.min.x());
+    const int last_x = std::min(b_screen.x(), (transpose ? bounds.max.y() : bounds.max.x()) - 1);
+
+    for (int x = first_x; x <= last_x; ++x) {
         float t = (x - a_screen.x()) / static_cast<float>(b_screen.x() - a_screen.x());
         int y = a_screen.y() + t * (b_screen.y() - a_screen.y());
 
         if (transpose) {
-            if (y < 0 || y >= frame_buffer.width() || x < 0 || x >= frame_buffer.height()) {
+            if (!bounds.contains(y, x)) {
                 continue;
             }
-            frame_buffer[y, x] = color;
+            frame_buffer.store(y, x, packed);
         } else {
-            if (x < 0 || x >= frame_buffer.width() || y < 0 || y >= frame_buffer.height()) {
+            if (!bounds.contains(x, y)) {
                 continue;
             }
-            frame_buffer[x, y] = color;
+            frame_buffer.store(x, y, packed);
         }
     }
 }
 
 void draw_triangle(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, const Color3& color) {
-    ZoneScopedN("draw_triangle"); // Add Tracy profiling for this function
-    draw_line(a, b, frame_buffer, color);
-    draw_line(b, c, frame_buffer, color);
-    draw_line(c, a, frame_buffer, color);
+    draw_triangle(a, b, c, frame_buffer, color, full_frame(frame_buffer));
 }
 
-void draw_triangle_filled(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, ZBuffer& z_buffer,
-                          const Color3& color) {
-    ZoneScopedN("draw_triangle_filled"); // Add Tracy profiling for this function
+void draw_triangle(const Vec3f& a, const Vec3f& b, const Vec3f& c, FrameBuffer& frame_buffer, const Color3& color,
+                   const Rect2i& clip) {
+    PROFILE_FINE("draw_triangle"); // Add Tracy profiling for this function
+    draw_line(a, b, frame_buffer, color, clip);
+    draw_line(b, c, frame_buffer, color, clip);
+    draw_line(c, a, frame_buffer, color, clip);
+}
 
-    // TODO: Consider moving these statics somewhere else
-    static std::mutex screen_cache_mutex;
-    static std::unordered_map<Vec3f, Vec2i> screen_cache{};
-    // TODO: Make this an option in a config class
-    constexpr bool use_cache = true; // Used to compare performance with and without cache
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color) {
+    draw_triangle_filled(a, b, c, frame_buffer, z_buffer, color, full_frame(frame_buffer));
+}
 
-    // Convert to screen space
-    screen_cache_mutex.lock();
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color, const Rect2i& clip) {
+    draw_triangle_filled<true, true>(a, b, c, frame_buffer, z_buffer, color, clip, nullptr);
+}
 
-    if (!use_cache) {
-        screen_cache.clear();
-    }
+template <bool DepthTest, bool DepthWrite>
+void draw_triangle_filled(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+                          FrameBuffer& frame_buffer, ZBuffer& z_buffer, const Color3& color, const Rect2i& clip,
+                          FragmentCounters* counters) {
+    PROFILE_FINE("draw_triangle_filled"); // Add Tracy profiling for this function
 
-    if (screen_cache.find(a) == screen_cache.end()) {
-        screen_cache[a] = to_screen_space(a, frame_buffer.width(), frame_buffer.height());
-    }
-    if (screen_cache.find(b) == screen_cache.end()) {
-        screen_cache[b] = to_screen_space(b, frame_buffer.width(), frame_buffer.height());
-    }
-    if (screen_cache.find(c) == screen_cache.end()) {
-        screen_cache[c] = to_screen_space(c, frame_buffer.width(), frame_buffer.height());
+    const Vec2i& a_screen = a.position;
+    const Vec2i& b_screen = b.position;
+    const Vec2i& c_screen = c.position;
+
+    auto [top_left, bottom_right] = find_bounding_box(a_screen, b_screen, c_screen);
+    const Rect2i bounds =
+        Rect2i{top_left, bottom_right + Vec2i{1, 1}}.intersect(clip).intersect(full_frame(frame_buffer));
+
+    const int total_area = static_cast<int>(signed_triangle_area(a_screen, b_screen, c_screen));
+    if (total_area == 0 || bounds.empty()) {
+        // Degenerate triangles don't cover any pixels
+        return;
     }
 
-    Vec2i& a_screen = screen_cache[a];
-    Vec2i& b_screen = screen_cache[b];
-    Vec2i& c_screen = screen_cache[c];
+    // Orient the edges so that all 3 are >= 0 inside of the triangle, whichever way it winds
+    const int winding = total_area > 0 ? 1 : -1;
+    const EdgeFunction e0{b_screen, c_screen, winding};
+    const EdgeFunction e1{c_screen, a_screen, winding};
+    const EdgeFunction e2{a_screen, b_screen, winding};
 
-    screen_cache_mutex.unlock();
+    // The barycentric weights are the edge functions over the area, so depth is a plane that can be stepped across the
+    // screen. It is evaluated relative to `a`, as z(x, y) = a.depth + dz_dy * (y - a.y) + dz_dx * (x - a.x) - anchoring
+    // it at the screen origin instead loses precision to large products that cancel out
+    const float inv_area = 1.f / static_cast<float>(total_area * winding);
+    const float dz_dx = (e0.a * a.depth + e1.a * b.depth + e2.a * c.depth) * inv_area;
+    const float dz_dy = (e0.b * a.depth + e1.b * b.depth + e2.b * c.depth) * inv_area;
 
-    auto [top_left, bottom_right] = find_bounding_box(a_screen, b_screen, c_screen);
+    // Start each row on a lane boundary of the clip region - lanes outside of the triangle get masked out, and the
+    // clip region is owned by the caller so the extra pixels can safely be read
+    const Rect2i limit = clip.intersect(full_frame(frame_buffer));
+    const int start_x = limit.min.x() + (bounds.min.x() - limit.min.x()) / lanes * lanes;
+
+    // Convert the color to the storage format once, rather than for every pixel
+    const FrameBuffer::PackedColor packed = frame_buffer.pack(color);
+
+    const IntBatch lane_index = lane_indices();
+    const FloatBatch lane_offset = xsimd::batch_cast<float>(lane_index);
+
+    // Rounding can take the depths inside of the bounds a few ulps past those at its corners, so the range checks
+    // below leave that much room
+    const float depth_slop = (std::abs(a.depth) + std::abs(dz_dx) * (bottom_right.x() - top_left.x() + 1) +
+                              std::abs(dz_dy) * (bottom_right.y() - top_left.y() + 1)) *
+                             0x1p-21f;
+    auto row_depth = [&](int y) { return a.depth + dz_dy * static_cast<float>(y - a_screen.y()); };
+    auto depth_at = [&](int x, int y) { return row_depth(y) + dz_dx * static_cast<float>(x - a_screen.x()); };
+
+    // Depth is a plane, so its extremes over the bounds are at the corners
+    const int x_1 = bounds.max.x() - 1;
+    const int y_1 = bounds.max.y() - 1;
+    auto [z_low, z_high] = std::minmax({depth_at(bounds.min.x(), bounds.min.y()), depth_at(x_1, bounds.min.y()),
+                                        depth_at(bounds.min.x(), y_1), depth_at(x_1, y_1)});
+    z_low -= depth_slop;
+    z_high += depth_slop;
+
+    // Check the triangle against the depth ranges of the z buffer cells under it, before doing any per-pixel work
+    constexpr int cell_size = ZBuffer::cell_size;
+    std::uint64_t in_front = ~std::uint64_t{0};
+    if constexpr (DepthTest) {
+        float farthest = std::numeric_limits<float>::infinity();
+        float closest = -std::numeric_limits<float>::infinity();
+        for (int cell_y = bounds.min.y() / cell_size; cell_y <= y_1 / cell_size; ++cell_y) {
+            for (int cell_x = bounds.min.x() / cell_size; cell_x <= x_1 / cell_size; ++cell_x) {
+                farthest = std::min(farthest, z_buffer.cell_min(cell_x, cell_y));
+                closest = std::max(closest, z_buffer.cell_max(cell_x, cell_y));
+            }
+        }
+        if (z_high <= farthest) {
+            // Every pixel under the triangle is already at least as close as it is
+            return;
+        }
+        // When the triangle is in front of everything under it, every pixel it covers passes the depth test
+        in_front = z_low > closest ? ~std::uint64_t{0} : 0;
+    }
 
-    double total_area = signed_triangle_area(a_screen, b_screen, c_screen);
+    bool written = false;
+    std::uint64_t tested = 0;
+    std::uint64_t passed = 0;
 
-    for (int x = std::max(0, top_left.x()); x <= std::min(bottom_right.x(), frame_buffer.width() - 1); ++x) {
-        for (int y = std::max(0, top_left.y()); y <= std::min(bottom_right.y(), frame_buffer.height() - 1); ++y) {
-            Vec2i p{x, y};
+    for (int y = bounds.min.y(); y < bounds.max.y(); ++y) {
+        IntBatch w0 = e0.at(start_x + lane_index, y);
+        IntBatch w1 = e1.at(start_x + lane_index, y);
+        IntBatch w2 = e2.at(start_x + lane_index, y);
 
-            // Check if the point is inside the triangle using barycentric coordinates
-            double alpha = signed_triangle_area(p, b_screen, c_screen) / total_area;
-            double beta = signed_triangle_area(p, c_screen, a_screen) / total_area;
-            double gamma = signed_triangle_area(p, a_screen, b_screen) / total_area;
+        float* depth_row = z_buffer.row(y);
+        const float z_row = row_depth(y);
 
-            if (alpha >= 0.0 && beta >= 0.0 && gamma >= 0.0) {
-                // Point is in the triangle
+        for (int x = start_x; x < bounds.max.x(); x += lanes) {
+            // A pixel is inside when none of the edge functions have their sign bit set
+            std::uint64_t covered = ((w0 | w1 | w2) >= 0).mask();
+            w0 += e0.a * lanes;
+            w1 += e1.a * lanes;
+            w2 += e2.a * lanes;
+            if (covered == 0) {
+                continue;
+            }
+
+            std::uint64_t visible = 0;
+            if (x + lanes <= limit.max.x()) {
+                if constexpr (DepthTest || DepthWrite) {
+                    const FloatBatch z = z_row + dz_dx * (static_cast<float>(x - a_screen.x()) + lane_offset);
+                    const FloatBatch depth = FloatBatch::load_unaligned(depth_row + x);
 
-                // Get z value
-                float z = alpha * a.z() + beta * b.z() + gamma * c.z();
-                z_buffer.lock(x, y);
-                if (z > z_buffer[x, y]) {
                     // Z buffer test
-                    frame_buffer[x, y] = color;
-                    z_buffer[x, y] = z;
+                    visible = DepthTest ? covered & ((z > depth).mask() | in_front) : covered;
+                    if constexpr (DepthWrite) {
+                        xsimd::select(FloatBatch::batch_bool_type::from_mask(visible), z, depth)
+                            .store_unaligned(depth_row + x);
+                    }
+                } else {
+                    visible = covered;
+                }
+            } else {
+                // The last few pixels of the clip region don't fill a whole batch
+                covered &= (std::uint64_t{1} << (limit.max.x() - x)) - 1;
+                for (std::uint64_t bits = covered; bits != 0; bits &= bits - 1) {
+                    const int lane = std::countr_zero(bits);
+                    const float z = z_row + dz_dx * static_cast<float>(x + lane - a_screen.x());
+                    if (!DepthTest || z > depth_row[x + lane] || in_front != 0) {
+                        if constexpr (DepthWrite) {
+                            depth_row[x + lane] = z;
+                        }
+                        visible |= std::uint64_t{1} << lane;
+                    }
                 }
-                z_buffer.unlock(x, y);
+            }
+            tested += std::popcount(covered);
+            if (visible == 0) {
+                continue;
+            }
+
+            written = true;
+            passed += std::popcount(visible);
+            for (std::uint64_t bits = visible; bits != 0; bits &= bits - 1) {
+                frame_buffer.store(x + std::countr_zero(bits), y, packed);
             }
         }
     }
-}
\ No newline at end of file
+
+    if (counters) {
+        counters->tested += tested;
+        counters->passed += passed;
+    }
+
+    // Keep the closest depths of the cells that may have been written to conservative
+    if (DepthWrite && written) {
+        for (int cell_y = bounds.min.y() / cell_size; cell_y <= y_1 / cell_size; ++cell_y) {
+            for (int cell_x = bounds.min.x() / cell_size; cell_x <= x_1 / cell_size; ++cell_x) {
+                z_buffer.raise_cell_max(cell_x, cell_y, z_high);
+            }
+        }
+    }
+}
+
+template void draw_triangle_filled<false, false>(const ScreenVertex&, const ScreenVertex&, const ScreenVertex&,
+                                                 FrameBuffer&, ZBuffer&, const Color3&, const Rect2i&,
+                                                 FragmentCounters*);
+template void draw_triangle_filled<false, true>(const ScreenVertex&, const ScreenVertex&, const ScreenVertex&,
+                                                FrameBuffer&, ZBuffer&, const Color3&, const Rect2i&,
+                                                FragmentCounters*);
+template void draw_triangle_filled<true, false>(const ScreenVertex&, const ScreenVertex&, const ScreenVertex&,
+                                                FrameBuffer&, ZBuffer&, const Color3&, const Rect2i&,
+                                                FragmentCounters*);
+template void draw_triangle_filled<true, true>(const ScreenVertex&, const ScreenVertex&, const ScreenVertex&,
+                                               FrameBuffer&, ZBuffer&, const Color3&, const Rect2i&,
+                                               FragmentCounters*);
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "render_context.hpp" // self
+
+namespace {
+
+// The contexts of the calling thread, one for every level of draws that have been nested on it so far
+struct ThreadContexts {
+    std::vector<std::unique_ptr<RenderContext>> contexts{};
+    std::size_t in_use{0}; // Nested draws finish before the ones they were started from, so they are leased in order
+};
+
+thread_local ThreadContexts thread_contexts{};
+
+} // namespace
+
+RenderContext::Lease RenderContext::for_this_thread() {
+    ThreadContexts& thread = thread_contexts;
+    if (thread.in_use == thread.contexts.size()) {
+        thread.contexts.push_back(std::make_unique<RenderContext>());
+    }
+    return Lease{*thread.contexts[thread.in_use++]};
+}
+
+RenderContext::Lease::~Lease() { --thread_contexts.in_use; }
+
+ZBuffer& RenderContext::cleared_z_buffer(int width, int height) {
+    m_history.valid = false;
+    if (m_z_buffer.width() != width || m_z_buffer.height() != height) {
+        m_z_buffer = ZBuffer{width, height};
+    } else {
+        m_z_buffer.clear();
+    }
+    return m_z_buffer;
+}
+
+RenderContext& RenderContext::view(std::size_t index) {
+    while (m_views.size() <= index) {
+        m_views.push_back(std::make_unique<RenderContext>(*m_pool));
+    }
+    return *m_views[index];
+}
@@ -1,179 +1,1000 @@
 #include "renderer.hpp"
+#include "clipper.hpp"
 #include "primitives.hpp"
+#include "render_context.hpp"
+#include "scene.hpp"
+#include "tile_binner.hpp"
 #include "types/matrix.hpp"
 #include "types/z_buffer.hpp"
-#include "utils/timer.hpp"
-
-#include <tracy/Tracy.hpp> // Tracy profiling
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
+#include "vertex_stage.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic> // std::atomic_ref
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <future>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 namespace {
 
-template <typename F> void async_for(std::size_t start, std::size_t end, F func) {
-    std::vector<std::future<void>> futures{};
-    constexpr bool parallelize = true;
-    const std::size_t num_threads = parallelize ? std::thread::hardware_concurrency() : 1;
-    const std::size_t chunk_size = (end - start) / num_threads;
+using Mode = PipelineState::Mode;
 
-    for (int t = 0; t < num_threads; ++t) {
-        std::size_t chunk_start = start + t * chunk_size;
-        std::size_t chunk_end = (t == num_threads - 1) ? end : chunk_start + chunk_size;
+// Each tile updates the depth ranges of its own z buffer cells, so no cell can straddle two tiles
+static_assert(TileBinner::tile_size % ZBuffer::cell_size == 0, "Tiles must be made of whole z buffer cells");
 
-        futures.emplace_back(std::async(std::launch::async, [&, chunk_start, chunk_end]() {
-            for (std::size_t i = chunk_start; i < chunk_end; ++i) {
-                func(i);
-            }
-        }));
+std::size_t thread_count(const ThreadPool& pool, bool parallelize) { return parallelize ? pool.concurrency() : 1; }
+
+template <typename F>
+void async_for(ThreadPool& pool, bool parallelize, std::size_t start, std::size_t end, F func,
+               std::size_t min_grain = 1) {
+    if (!parallelize) {
+        for (std::size_t i = start; i < end; ++i) {
+            func(i);
+        }
+        return;
     }
 
-    for (auto& future : futures) {
-        future.get();
+    pool.parallel_for(start, end, func, min_grain);
+}
+
+using Clock = std::chrono::steady_clock;
+
+double nanoseconds_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Adds the time between its construction and destruction onto `total`, if there is one
+class StageTimer {
+public:
+    explicit StageTimer(double* total) : m_total{total}, m_start{total ? Clock::now() : Clock::time_point{}} {}
+    ~StageTimer() {
+        if (m_total) {
+            *m_total += nanoseconds_since(m_start);
+        }
     }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    double* m_total;
+    Clock::time_point m_start;
+};
+
+// For counters that several tasks add onto at once
+template <typename T> void add(T& counter, std::type_identity_t<T> value) {
+    std::atomic_ref{counter}.fetch_add(value, std::memory_order_relaxed);
 }
 
-// TODO: Reorganize
-std::vector<Vec4f> to_view_space(const std::vector<Vec3f>& object_vertices, const Matrix4x4f& transform_mat,
-                                 const Matrix4x4f& view_mat) {
-    ZoneScopedN("to_view_space");
+// Runs `task`, adding how long it took onto the busy time of the calling thread when there are stats
+template <typename F> void timed_task(RenderStats* stats, const ThreadPool& pool, F&& task) {
+    if (!stats) {
+        task();
+        return;
+    }
+    const Clock::time_point start = Clock::now();
+    task();
+    // Every thread that isn't one of the pool's workers shares the last entry - the thread that started the draw, but
+    // also any other thread drawing on the same pool that picks up one of its tasks while waiting on its own
+    add(stats->threads[pool.thread_index()].busy_ns, nanoseconds_since(start));
+}
+
+// Resets the stats of a draw, and returns where its counters should go. When they are plotted in Tracy, draws that
+// weren't asked for stats gather them into `local` instead, so that every frame shows up in the plots
+RenderStats* begin_stats(RenderStats* stats, [[maybe_unused]] RenderStats& local, const ThreadPool& pool) {
+#if RASTER_INSTRUMENTATION >= 1
+    if (!stats) {
+        stats = &local;
+    }
+#endif
+    if (stats) {
+        *stats = RenderStats{};
+        stats->threads.resize(pool.concurrency());
+    }
+    return stats;
+}
 
-    Timer timer("Convert to View Space");
+// Fills in what can only be known at the end of a draw, and plots the counters in Tracy
+void end_stats(RenderStats* stats, const ZBuffer& z_buffer, Clock::time_point start) {
+    if (!stats) {
+        return;
+    }
 
-    std::vector<Vec4f> view_space_vertices{};
-    view_space_vertices.resize(object_vertices.size());
-    auto task = [&](std::size_t i) {
-        const auto& vertex = object_vertices[i];
-        Matrix<float, 4, 1> object_space{vertex.x(), vertex.y(), vertex.z(), 1.f};
+    stats->times.total_ns = nanoseconds_since(start);
+    for (auto& thread : stats->threads) {
+        // Binning and rasterizing are the stages that are spread over the threads
+        thread.idle_ns = std::max(0., stats->times.bin_ns + stats->times.raster_ns - thread.busy_ns);
+    }
+    stats->pixels_covered = z_buffer.covered();
+
+    PROFILE_PLOT("Triangles submitted", static_cast<std::int64_t>(stats->triangles_submitted));
+    PROFILE_PLOT("Triangles culled (backface)", static_cast<std::int64_t>(stats->triangles_culled_backface));
+    PROFILE_PLOT("Triangles culled (frustum)", static_cast<std::int64_t>(stats->triangles_culled_frustum));
+    PROFILE_PLOT("Triangles culled (zero area)", static_cast<std::int64_t>(stats->triangles_culled_zero_area));
+    PROFILE_PLOT("Triangles clipped", static_cast<std::int64_t>(stats->triangles_clipped));
+    PROFILE_PLOT("Fragments tested", static_cast<std::int64_t>(stats->fragments_tested));
+    PROFILE_PLOT("Fragments passed", static_cast<std::int64_t>(stats->fragments_passed));
+    PROFILE_PLOT("Overdraw", stats->overdraw());
+}
 
-        // 2. Convert to world space
-        Matrix<float, 4, 1> world_space = transform_mat * object_space;
+Vec3f face_normal(const VertexStreams& vertices, const Object::Face& face) {
+    // Get the vertices of the triangle in view space
+    Vec3f v0_view = vertices.view(face[0]);
+    Vec3f v1_view = vertices.view(face[1]);
+    Vec3f v2_view = vertices.view(face[2]);
 
-        view_space_vertices[i] = world_space.col(0);
-        // 3. Convert to view space
-        Matrix<float, 4, 1> view_space = view_mat * world_space;
-        view_space_vertices[i] = view_space.col(0);
+    // Calculate the normal of the face
+    // TODO: Figure out why this only works when flipped
+    return (v1_view - v0_view).cross(v2_view - v0_view) * -1.f;
+}
+
+// The unit normal of every face in world space, from the world space positions of its vertices
+void world_face_normals(const Object& object, ThreadPool& pool, std::vector<Vec3f>& out) {
+    const Matrix4x4f model = object.transform_matrix();
+    const std::array<Vec4f, 3> rows{model.row(0), model.row(1), model.row(2)};
+    auto to_world = [&](const Vec3f& position) {
+        const Vec4f point{position.x(), position.y(), position.z(), 1.f};
+        return Vec3f{rows[0].dot(point), rows[1].dot(point), rows[2].dot(point)};
     };
 
-    async_for(0, object_vertices.size(), task);
+    const auto faces = object.faces();
+    const auto positions = object.vertices();
+    out.resize(faces.size());
+    pool.parallel_for(
+        0, faces.size(),
+        [&](std::size_t i) {
+            const Vec3f v0 = to_world(positions[faces[i][0]]);
+            const Vec3f v1 = to_world(positions[faces[i][1]]);
+            const Vec3f v2 = to_world(positions[faces[i][2]]);
+            out[i] = (v1 - v0).cross(v2 - v0).unit();
+        },
+        1024);
+}
+
+// Face normals that were worked out once in world space for all of the views of a multi-view draw, along with the
+// rotation that takes them into the space of one view. They come out the same as `face_normal`, just unit length
+struct SharedNormals {
+    std::span<const Vec3f> world{};
+    std::array<Vec3f, 3> rotation{};
+
+    SharedNormals(std::span<const Vec3f> world_normals, const Matrix4x4f& view) : world{world_normals} {
+        for (std::size_t row = 0; row < 3; ++row) {
+            rotation[row] = Vec3f{view.at(row, 0), view.at(row, 1), view.at(row, 2)};
+        }
+        // Rotating both edges rotates their cross product too, times the determinant of the rotation - and
+        // face_normal flips it on top of that
+        const float determinant = rotation[0].dot(rotation[1].cross(rotation[2]));
+        for (auto& row : rotation) {
+            row = row * (determinant < 0.f ? 1.f : -1.f);
+        }
+    }
+
+    Vec3f to_view(std::size_t face) const {
+        const Vec3f& normal = world[face];
+        return {rotation[0].dot(normal), rotation[1].dot(normal), rotation[2].dot(normal)};
+    }
+};
+
+// How far away the nearest point of a box is, as its smallest clip space w
+float nearest_w(const Bounds3f& bounds, const Matrix4x4f& mvp) {
+    const Vec4f w_row = mvp.row(3);
+    float nearest = std::numeric_limits<float>::infinity();
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec4f point{corner & 1 ? bounds.max.x() : bounds.min.x(), corner & 2 ? bounds.max.y() : bounds.min.y(),
+                          corner & 4 ? bounds.max.z() : bounds.min.z(), 1.f};
+        nearest = std::min(nearest, w_row.dot(point));
+    }
+    return nearest;
+}
+
+// Whether everything inside of a box would be hidden by what is already in the z buffer - an occlusion query against
+// the depth ranges of its cells, so it can miss some boxes that are hidden, but never claims a visible one is
+bool occluded(const Bounds3f& bounds, const Matrix4x4f& mvp, const ZBuffer& z_buffer) {
+    Rect2i pixels{{std::numeric_limits<int>::max(), std::numeric_limits<int>::max()},
+                  {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()}};
+    float closest = -std::numeric_limits<float>::infinity();
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec4f point{corner & 1 ? bounds.max.x() : bounds.min.x(), corner & 2 ? bounds.max.y() : bounds.min.y(),
+                          corner & 4 ? bounds.max.z() : bounds.min.z(), 1.f};
+        const Vec4f clip{mvp.row(0).dot(point), mvp.row(1).dot(point), mvp.row(2).dot(point), mvp.row(3).dot(point)};
+        if ((clip_code(clip, Vec2f{1.f, 1.f}) & ClipCode::near) != 0 || clip.w() <= 0.f) {
+            // Part of the box is too close to project - assume it can be seen
+            return false;
+        }
+
+        const Vec3f ndc{clip.x() / clip.w(), clip.y() / clip.w(), clip.z() / clip.w()};
+        const Vec2i screen = to_screen_space(ndc, z_buffer.width(), z_buffer.height());
+        pixels.min = Vec2i{std::min(pixels.min.x(), screen.x()), std::min(pixels.min.y(), screen.y())};
+        pixels.max = Vec2i{std::max(pixels.max.x(), screen.x() + 1), std::max(pixels.max.y(), screen.y() + 1)};
+        closest = std::max(closest, ndc.z());
+    }
+
+    // The rasterizer evaluates depth relative to a corner of each triangle, which can overshoot the depths at the
+    // corners by a few ulps
+    closest += std::abs(closest) * 0x1p-20f;
+    return z_buffer.hides(pixels, closest);
+}
+
+// The pixels that a box may cover once projected, padded for rounding - the whole frame when part of it is too close
+// to project, and nothing when it is out of view
+Rect2i screen_rect(const Bounds3f& bounds, const Matrix4x4f& mvp, int width, int height) {
+    const Rect2i frame{{0, 0}, {width, height}};
+    if (bounds.empty() || outside_frustum(bounds, mvp)) {
+        return {};
+    }
+
+    Rect2i pixels{{std::numeric_limits<int>::max(), std::numeric_limits<int>::max()},
+                  {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()}};
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec4f point{corner & 1 ? bounds.max.x() : bounds.min.x(), corner & 2 ? bounds.max.y() : bounds.min.y(),
+                          corner & 4 ? bounds.max.z() : bounds.min.z(), 1.f};
+        const Vec4f clip{mvp.row(0).dot(point), mvp.row(1).dot(point), mvp.row(2).dot(point), mvp.row(3).dot(point)};
+        if ((clip_code(clip, Vec2f{1.f, 1.f}) & ClipCode::near) != 0 || clip.w() <= 0.f) {
+            return frame;
+        }
+
+        const Vec3f ndc{clip.x() / clip.w(), clip.y() / clip.w(), clip.z() / clip.w()};
+        const Vec2i screen = to_screen_space(ndc, width, height);
+        pixels.min = Vec2i{std::min(pixels.min.x(), screen.x()), std::min(pixels.min.y(), screen.y())};
+        pixels.max = Vec2i{std::max(pixels.max.x(), screen.x() + 1), std::max(pixels.max.y(), screen.y() + 1)};
+    }
+
+    constexpr int padding = 2;
+    pixels.min = pixels.min - Vec2i{padding, padding};
+    pixels.max = pixels.max + Vec2i{padding, padding};
+    return pixels.intersect(frame);
+}
+
+// Calls `func` with the options of a pipeline state as compile-time constants, so that it can be instantiated once for
+// every combination of them
+template <typename F> void with_static_state(const PipelineState& state, F&& func) {
+    auto with_bool = [](bool value, auto&& next) {
+        if (value) {
+            next(std::true_type{});
+        } else {
+            next(std::false_type{});
+        }
+    };
+    auto with_mode = [&](auto mode) {
+        with_bool(state.cull_backfaces, [&](auto cull_backfaces) {
+            with_bool(state.depth_test, [&](auto depth_test) {
+                with_bool(state.depth_write,
+                          [&](auto depth_write) { func(mode, cull_backfaces, depth_test, depth_write); });
+            });
+        });
+    };
 
-    return view_space_vertices;
+    switch (state.mode) {
+        case Mode::Wireframe: return with_mode(std::integral_constant<Mode, Mode::Wireframe>{});
+        case Mode::Shaded: return with_mode(std::integral_constant<Mode, Mode::Shaded>{});
+        case Mode::Normals: return with_mode(std::integral_constant<Mode, Mode::Normals>{});
+        default: throw std::invalid_argument("Invalid renderer mode");
+    }
 }
 
-// TODO: Reorganize
-std::vector<Vec3f> apply_vertex_shader(const std::vector<Vec4f>& view_space, const Matrix4x4f& projection_mat) {
-    ZoneScopedN("apply_vertex_shader");
+// Runs an object through the whole pipeline. `selection` picks the faces to draw, in the order to draw them - all of
+// them are drawn in their own order when it is null. The face normals are worked out from the view space vertices
+// unless `normals` already has them. Only the tiles in `tiles` are rasterized, or all of them when it is null. The
+// depth ranges of the z buffer cells are only brought up to date afterwards if `update_depth_ranges` is set
+template <Mode mode, bool cull_backfaces, bool depth_test, bool depth_write>
+void draw_object(const Object& object, const std::vector<std::uint32_t>* selection, const SharedNormals* normals,
+                 const std::vector<std::uint32_t>* tiles, const Matrix4x4f& model_view, const Matrix4x4f& projection,
+                 FrameBuffer& frame_buffer, RenderContext& context, bool parallelize, bool update_depth_ranges,
+                 RenderStats* stats) {
+    ThreadPool& pool = context.pool();
+    ZBuffer& z_buffer = context.z_buffer();
+    TileBinner& binner = context.binner();
+    VertexStreams& vertices = context.vertices();
+    auto& clipped = context.clipped();
+
+    const Vec2f guard = guard_band(frame_buffer.width(), frame_buffer.height());
+
+    auto unit_normal = [&](std::size_t i) {
+        return normals ? normals->to_view(i) : face_normal(vertices, object.faces()[i]).unit();
+    };
 
-    Timer timer("Apply Vertex Shader");
+    // 1. Transform to view space, clip space, normalized device coordinates (NDC) and pixel coordinates
+    {
+        StageTimer timer{stats ? &stats->times.vertex_ns : nullptr};
+        run_vertex_stage(object.vertices(), model_view, projection, frame_buffer.width(), frame_buffer.height(),
+                         vertices, pool, parallelize);
+    }
 
-    std::vector<Vec3f> ndc_vertices{};
-    ndc_vertices.resize(view_space.size());
-    auto task = [&](std::size_t i) {
-        // 3. Convert to clip space
-        Matrix<float, 4, 1> view_space_mat{view_space[i].x(), view_space[i].y(), view_space[i].z(), view_space[i].w()};
-        Matrix<float, 4, 1> clip_matrix = projection_mat * view_space_mat;
-        Vec4f clip_space = clip_matrix.col(0);
+    // 2. Sort the faces into screen tiles. Each stream bins a contiguous range of the faces, so every tile still sees
+    // them in the order they were given in
+    const auto faces = object.faces();
+    const std::size_t face_count = selection ? selection->size() : faces.size();
+    const std::size_t num_streams = std::clamp<std::size_t>(face_count, 1, thread_count(pool, parallelize));
+    binner.reset(frame_buffer.width(), frame_buffer.height(), num_streams);
+    clipped.resize(num_streams);
+
+    // Triangles that had to be clipped are binned after the faces, interleaved by stream so that every stream can
+    // hand out ids without knowing how many the others have
+    auto clipped_id = [&](std::size_t stream, std::size_t index) {
+        return static_cast<std::uint32_t>(faces.size() + index * num_streams + stream);
+    };
+    // Returns false for triangles that don't cover any pixels once snapped to them - their edges are still drawn as
+    // wireframes, though
+    auto bin_triangle = [&](std::size_t stream, std::uint32_t id, const Vec2i& a, const Vec2i& b, const Vec2i& c) {
+        if constexpr (mode != Mode::Wireframe) {
+            const Vec2i ab = b - a;
+            const Vec2i ac = c - a;
+            if (static_cast<std::int64_t>(ab.x()) * ac.y() == static_cast<std::int64_t>(ab.y()) * ac.x()) {
+                return false;
+            }
+        }
+        Rect2i bounds{{std::min({a.x(), b.x(), c.x()}), std::min({a.y(), b.y(), c.y()})},
+                      {std::max({a.x(), b.x(), c.x()}) + 1, std::max({a.y(), b.y(), c.y()}) + 1}};
+        binner.bin(stream, id, bounds);
+        return true;
+    };
 
-        // 4. Convert to normalized device coordinates (NDC)
-        // TODO: Consider making ndc [0, 1] instead of [-1, 1]
-        Vec3f ndc = Vec3f{clip_space.x(), clip_space.y(), clip_space.z()} / clip_space.w();
+    auto bin_task = [&](std::size_t stream) {
+        auto& stream_clipped = clipped[stream];
+        stream_clipped.clear();
+
+        std::uint64_t culled_backface = 0;
+        std::uint64_t culled_frustum = 0;
+        std::uint64_t culled_zero_area = 0;
+        std::uint64_t triangles_clipped = 0;
+
+        const std::size_t first = face_count * stream / num_streams;
+        const std::size_t last = face_count * (stream + 1) / num_streams;
+        for (std::size_t k = first; k < last; ++k) {
+            const std::size_t i = selection ? (*selection)[k] : k;
+            const auto& face = faces[i];
+
+            if constexpr (cull_backfaces) {
+                if ((normals ? normals->to_view(i) : face_normal(vertices, face)).z() <= 0.f) {
+                    // Cull the backface
+                    ++culled_backface;
+                    continue;
+                }
+            }
+
+            const std::int32_t code_a = vertices.clip_code[face[0]];
+            const std::int32_t code_b = vertices.clip_code[face[1]];
+            const std::int32_t code_c = vertices.clip_code[face[2]];
+            if ((code_a & code_b & code_c & ClipCode::frustum) != 0) {
+                // All 3 vertices are outside of the same plane, so none of the triangle can be seen
+                ++culled_frustum;
+                continue;
+            }
 
-        ndc_vertices[i] = std::move(ndc);
+            const std::int32_t codes = code_a | code_b | code_c;
+            if ((codes & ClipCode::needs_clipping) != 0) {
+                ++triangles_clipped;
+                const std::size_t first_clipped = stream_clipped.size();
+                clip_triangle({vertices.clip(face[0]), vertices.clip(face[1]), vertices.clip(face[2])}, codes,
+                              guard, frame_buffer.width(), frame_buffer.height(), static_cast<std::uint32_t>(i),
+                              stream_clipped);
+                for (std::size_t j = first_clipped; j < stream_clipped.size(); ++j) {
+                    const auto& screen = stream_clipped[j].screen;
+                    bin_triangle(stream, clipped_id(stream, j), screen[0].position, screen[1].position,
+                                 screen[2].position);
+                }
+                continue;
+            }
+
+            if (!bin_triangle(stream, static_cast<std::uint32_t>(i), vertices.screen(face[0]).position,
+                              vertices.screen(face[1]).position, vertices.screen(face[2]).position)) {
+                ++culled_zero_area;
+            }
+        }
+
+        if (stats) {
+            add(stats->triangles_culled_backface, culled_backface);
+            add(stats->triangles_culled_frustum, culled_frustum);
+            add(stats->triangles_culled_zero_area, culled_zero_area);
+            add(stats->triangles_clipped, triangles_clipped);
+        }
     };
 
-    async_for(0, view_space.size(), task);
+    if (stats) {
+        stats->triangles_submitted += face_count;
+    }
+    {
+        PROFILE_STAGE("Bin");
+        StageTimer timer{stats ? &stats->times.bin_ns : nullptr};
+        async_for(pool, parallelize, 0, num_streams,
+                  [&](std::size_t stream) { timed_task(stats, pool, [&] { bin_task(stream); }); });
+    }
+
+    // 3. Rasterize - every tile is owned by exactly one thread, so no pixel is ever touched concurrently
+    auto draw_face = [&](std::uint32_t id, const Rect2i& tile, FragmentCounters* counters) {
+        // Ids past the faces are triangles that were clipped - they are still lit by the face they came from
+        const ClippedTriangle* clipped_triangle = nullptr;
+        if (id >= faces.size()) {
+            const std::size_t index = id - faces.size();
+            clipped_triangle = &clipped[index % num_streams][index / num_streams];
+        }
+        const std::uint32_t face_index = clipped_triangle ? clipped_triangle->face : id;
+        const auto& face = faces[face_index];
+        auto ndc = [&](int k) { return clipped_triangle ? clipped_triangle->ndc[k] : vertices.ndc(face[k]); };
+        auto screen = [&](int k) {
+            return clipped_triangle ? clipped_triangle->screen[k] : vertices.screen(face[k]);
+        };
+
+        if constexpr (mode == Mode::Wireframe) {
+            Color3 color = Colors::white;
+            draw_triangle(ndc(0), ndc(1), ndc(2), frame_buffer, color, tile);
+        } else if constexpr (mode == Mode::Shaded) {
+            // Calculate the light intensity based on the angle between the normal and the light direction
+            Vec3f light_direction = Vec3f{1.f, 1.f, 1.f}.unit(); // Light points into the screen
+            // Some ambient light
+            const float intensity = std::max(0.01f, unit_normal(face_index).dot(light_direction));
+
+            // Use the intensity to shade the color
+            Color3 color = {intensity, intensity, intensity};
+            draw_triangle_filled<depth_test, depth_write>(screen(0), screen(1), screen(2), frame_buffer, z_buffer,
+                                                          color, tile, counters);
+        } else {
+            const Vec3f normal = unit_normal(face_index);
+
+            float r = std::abs(normal.x());
+            float g = std::abs(normal.y());
+            float b = std::abs(normal.z());
+
+            Color3 color{r, g, b};
+            draw_triangle_filled<depth_test, depth_write>(screen(0), screen(1), screen(2), frame_buffer, z_buffer,
+                                                          color, tile, counters);
+        }
+    };
 
-    return ndc_vertices;
+    auto raster_task = [&](std::size_t tile) {
+        const Rect2i tile_rect = binner.tile_rect(static_cast<int>(tile));
+        FragmentCounters counters{};
+        bool drawn = false;
+        binner.for_each(static_cast<int>(tile), [&](std::uint32_t i) {
+            draw_face(i, tile_rect, stats ? &counters : nullptr);
+            drawn = true;
+        });
+
+        if (stats) {
+            add(stats->fragments_tested, counters.tested);
+            add(stats->fragments_passed, counters.passed);
+        }
+
+        // Wireframes and draws without depth writes leave the z buffer as it was
+        if (mode != Mode::Wireframe && depth_write && drawn && update_depth_ranges) {
+            z_buffer.update_cells(tile_rect);
+        }
+    };
+
+    PROFILE_STAGE("Rasterize");
+    StageTimer timer{stats ? &stats->times.raster_ns : nullptr};
+    async_for(pool, parallelize, 0, tiles ? tiles->size() : binner.tile_count(), [&](std::size_t i) {
+        timed_task(stats, pool, [&] { raster_task(tiles ? (*tiles)[i] : i); });
+    });
+}
+
+// Picks the instantiation of the pipeline for the state once, rather than checking it for every face
+void draw_object(const Object& object, const std::vector<std::uint32_t>* selection, const SharedNormals* normals,
+                 const std::vector<std::uint32_t>* tiles, const Matrix4x4f& model_view, const Matrix4x4f& projection,
+                 FrameBuffer& frame_buffer, RenderContext& context, const PipelineState& state,
+                 bool update_depth_ranges, RenderStats* stats) {
+    with_static_state(state, [&](auto mode, auto cull_backfaces, auto depth_test, auto depth_write) {
+        draw_object<mode(), cull_backfaces(), depth_test(), depth_write()>(object, selection, normals, tiles,
+                                                                           model_view, projection, frame_buffer,
+                                                                           context, state.parallelize,
+                                                                           update_depth_ranges, stats);
+    });
+}
+
+// Draws each of the objects that is in view, in turn
+void draw_objects(RenderContext& context, std::span<const Object> objects, const Camera& camera,
+                  FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    const Clock::time_point start = Clock::now();
+    RenderStats local_stats{};
+    stats = begin_stats(stats, local_stats, context.pool());
+    ZBuffer& z_buffer = context.cleared_z_buffer(frame_buffer.width(), frame_buffer.height());
+
+    float aspect_ratio = static_cast<float>(frame_buffer.width()) / static_cast<float>(frame_buffer.height());
+    const Matrix4x4f projection = camera.projection_matrix(aspect_ratio);
+
+    for (const auto& object : objects) {
+        const Matrix4x4f model_view = camera.view_matrix() * object.transform_matrix();
+        if (outside_frustum(object.bounds(), projection * model_view)) {
+            // None of the object can be seen, so skip all of its vertices and faces
+            if (stats) {
+                ++stats->objects_culled;
+            }
+            continue;
+        }
+
+        // The depth ranges of the z buffer cells only need to be tight for the objects still to come
+        draw_object(object, nullptr, nullptr, nullptr, model_view, projection, frame_buffer, context, state,
+                    &object != &objects.back(), stats);
+    }
+
+    if (stats) {
+        stats->objects_submitted = objects.size();
+    }
+    end_stats(stats, z_buffer, start);
+}
+
+// Draws the objects and clusters of faces of the scene that are in view, front to back. The face normals of each object
+// come from `world_normals` when it is given
+void draw_scene(RenderContext& context, const Scene& scene, const std::vector<std::vector<Vec3f>>* world_normals,
+                const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    const Clock::time_point start = Clock::now();
+    RenderStats local_stats{};
+    stats = begin_stats(stats, local_stats, context.pool());
+    ZBuffer& z_buffer = context.cleared_z_buffer(frame_buffer.width(), frame_buffer.height());
+
+    float aspect_ratio = static_cast<float>(frame_buffer.width()) / static_cast<float>(frame_buffer.height());
+    const Matrix4x4f projection = camera.projection_matrix(aspect_ratio);
+    const Matrix4x4f view = camera.view_matrix();
+    const Matrix4x4f view_projection = projection * view;
+
+    // The faces of the object being drawn that are in view, nearest cluster first
+    std::vector<std::uint32_t> selection{};
+    std::uint64_t objects_drawn = 0;
+
+    // What has been drawn can only hide what comes after it when the draws are depth tested against it
+    const bool occlusion_culling = state.mode != Mode::Wireframe && state.depth_test && state.depth_write;
+    auto hidden = [&](const Bounds3f& bounds, const Matrix4x4f& mvp) {
+        return occlusion_culling && occluded(bounds, mvp, z_buffer);
+    };
+
+    // Walk the objects nearest first, so the ones in front fill in the z buffer before the ones behind them are tested
+    scene.object_bvh().traverse(
+        [&](const Bounds3f& bounds) {
+            return !outside_frustum(bounds, view_projection) && !hidden(bounds, view_projection);
+        },
+        [&](const Bounds3f& bounds) { return nearest_w(bounds, view_projection); },
+        [&](std::span<const std::uint32_t> items) {
+            for (const std::uint32_t index : items) {
+                const Object& object = scene.objects()[index];
+                const Matrix4x4f model_view = view * object.transform_matrix();
+                const Matrix4x4f mvp = projection * model_view;
+
+                // Then do the same for the clusters of its faces
+                selection.clear();
+                scene.face_bvh(index).traverse(
+                    [&](const Bounds3f& bounds) {
+                        return !outside_frustum(bounds, mvp) && !hidden(bounds, mvp);
+                    },
+                    [&](const Bounds3f& bounds) { return nearest_w(bounds, mvp); },
+                    [&](std::span<const std::uint32_t> faces) {
+                        selection.insert(selection.end(), faces.begin(), faces.end());
+                    });
+
+                if (!selection.empty()) {
+                    const std::optional<SharedNormals> normals =
+                        world_normals ? std::optional{SharedNormals{(*world_normals)[index], view}} : std::nullopt;
+                    draw_object(object, &selection, normals ? &*normals : nullptr, nullptr, model_view, projection,
+                                frame_buffer, context, state, true, stats);
+                    ++objects_drawn;
+                }
+            }
+        });
+
+    if (stats) {
+        stats->objects_submitted = scene.objects().size();
+        stats->objects_culled = stats->objects_submitted - objects_drawn;
+    }
+    end_stats(stats, z_buffer, start);
+}
+
+// Draws the mesh once for every model matrix - they go on top of the mesh's own transform
+void draw_instances(RenderContext& context, const Object& mesh, std::span<const Matrix4x4f> models,
+                    const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    const Clock::time_point start = Clock::now();
+    RenderStats local_stats{};
+    stats = begin_stats(stats, local_stats, context.pool());
+    ZBuffer& z_buffer = context.cleared_z_buffer(frame_buffer.width(), frame_buffer.height());
+
+    float aspect_ratio = static_cast<float>(frame_buffer.width()) / static_cast<float>(frame_buffer.height());
+    const Matrix4x4f projection = camera.projection_matrix(aspect_ratio);
+    const Matrix4x4f view = camera.view_matrix();
+    const Matrix4x4f view_projection = projection * view;
+
+    // Cull the instances that are out of view in one batch, and find how far away the rest are
+    RenderContext::Instances& instances = context.instances();
+    instances.nearest.resize(models.size());
+    {
+        PROFILE_STAGE("Cull instances");
+        async_for(
+            context.pool(), state.parallelize, 0, models.size(),
+            [&](std::size_t i) {
+                const Matrix4x4f mvp = view_projection * models[i] * mesh.transform_matrix();
+                instances.nearest[i] = mesh.bounds().empty() || outside_frustum(mesh.bounds(), mvp)
+                                           ? std::numeric_limits<float>::infinity()
+                                           : nearest_w(mesh.bounds(), mvp);
+            },
+            1024);
+    }
+
+    // Nearest first, so that the instances in front fill in the z buffer before those behind them are tested
+    instances.order.clear();
+    for (std::size_t i = 0; i < models.size(); ++i) {
+        if (instances.nearest[i] != std::numeric_limits<float>::infinity()) {
+            instances.order.push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+    std::stable_sort(instances.order.begin(), instances.order.end(),
+                     [&](std::uint32_t a, std::uint32_t b) { return instances.nearest[a] < instances.nearest[b]; });
+
+    // What has been drawn can only hide what comes after it when the draws are depth tested against it
+    const bool occlusion_culling = state.mode != Mode::Wireframe && state.depth_test && state.depth_write;
+
+    std::uint64_t instances_drawn = 0;
+    for (const std::uint32_t index : instances.order) {
+        const Matrix4x4f model_view = view * models[index] * mesh.transform_matrix();
+        if (occlusion_culling && occluded(mesh.bounds(), projection * model_view, z_buffer)) {
+            continue;
+        }
+
+        // The depth ranges only need to be tight for the instances still to come
+        draw_object(mesh, nullptr, nullptr, nullptr, model_view, projection, frame_buffer, context, state,
+                    index != instances.order.back(), stats);
+        ++instances_drawn;
+    }
+
+    if (stats) {
+        stats->objects_submitted = models.size();
+        stats->objects_culled = models.size() - instances_drawn;
+    }
+    end_stats(stats, z_buffer, start);
 }
 
 } // namespace
 
 void Renderer::draw(const Object& object, const Camera& camera, FrameBuffer& frame_buffer, Mode mode) {
-    draw(std::vector<Object>{object}, camera, frame_buffer, mode);
+    draw(object, camera, frame_buffer, PipelineState{.mode = mode});
 }
 
 void Renderer::draw(const std::vector<Object>& objects, const Camera& camera, FrameBuffer& frame_buffer, Mode mode) {
-    FrameMarkStart("Renderer::draw");
+    draw(objects, camera, frame_buffer, PipelineState{.mode = mode});
+}
 
-    // Only re-allocate the z-buffer if the size of the frame buffer has changed
-    static ZBuffer z_buffer{frame_buffer.width(), frame_buffer.height()};
-    if (z_buffer.size() != frame_buffer.width() * frame_buffer.height()) {
-        z_buffer = ZBuffer{frame_buffer.width(), frame_buffer.height()};
-    } else {
-        z_buffer.clear();
+void Renderer::draw(const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer, Mode mode) {
+    draw(scene, camera, frame_buffer, PipelineState{.mode = mode});
+}
+
+void Renderer::draw(const Object& object, const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                    RenderStats* stats) {
+    draw(*RenderContext::for_this_thread(), object, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw(const std::vector<Object>& objects, const Camera& camera, FrameBuffer& frame_buffer,
+                    const PipelineState& state, RenderStats* stats) {
+    draw(*RenderContext::for_this_thread(), objects, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw(const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                    RenderStats* stats) {
+    draw(*RenderContext::for_this_thread(), scene, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw(const Scene& scene, std::span<const Camera> cameras, std::span<FrameBuffer> frame_buffers,
+                    const PipelineState& state, std::span<RenderStats> stats) {
+    draw(*RenderContext::for_this_thread(), scene, cameras, frame_buffers, state, stats);
+}
+
+void Renderer::draw(const MeshStream& mesh, const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                    RenderStats* stats) {
+    draw(*RenderContext::for_this_thread(), mesh, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw_instanced(const Object& mesh, std::span<const Transform> instances, const Camera& camera,
+                              FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    draw_instanced(*RenderContext::for_this_thread(), mesh, instances, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw_instanced(const Object& mesh, std::span<const Matrix4x4f> instances, const Camera& camera,
+                              FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    draw_instanced(*RenderContext::for_this_thread(), mesh, instances, camera, frame_buffer, state, stats);
+}
+
+void Renderer::draw(RenderContext& context, const Object& object, const Camera& camera, FrameBuffer& frame_buffer,
+                    const PipelineState& state, RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+    draw_objects(context, std::span{&object, 1}, camera, frame_buffer, state, stats);
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw(RenderContext& context, const Scene& scene, const Camera& camera, FrameBuffer& frame_buffer,
+                    const PipelineState& state, RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+    draw_scene(context, scene, nullptr, camera, frame_buffer, state, stats);
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw(RenderContext& context, const Scene& scene, std::span<const Camera> cameras,
+                    std::span<FrameBuffer> frame_buffers, const PipelineState& state, std::span<RenderStats> stats) {
+    if (cameras.size() != frame_buffers.size() || (!stats.empty() && stats.size() != cameras.size())) {
+        throw std::invalid_argument("Every view needs a camera and a frame buffer (and stats, if any are asked for)");
+    }
+
+    PROFILE_FRAME_START("Renderer::draw");
+
+    // Worked out once for all of the views - wireframes only need them to cull backfaces
+    auto& world_normals = context.face_normals();
+    const bool needs_normals = state.mode != Mode::Wireframe || state.cull_backfaces;
+    if (needs_normals) {
+        PROFILE_STAGE("World face normals");
+        world_normals.resize(scene.objects().size());
+        for (std::size_t i = 0; i < scene.objects().size(); ++i) {
+            world_face_normals(scene.objects()[i], context.pool(), world_normals[i]);
+        }
     }
 
+    // When there are enough views to keep every thread busy, each view is drawn on a single thread, through a context
+    // claimed from a shared list of them - the one released last is claimed first, so a thread that draws views in
+    // turn tends to get the context it just used back, with its buffers still warm. No two views in flight ever share
+    // a context, however the pool schedules them. Otherwise every view gets a context of its own, and is drawn across
+    // the pool
+    ThreadPool& pool = context.pool();
+    const std::size_t threads = thread_count(pool, state.parallelize);
+    const bool view_per_thread = cameras.size() >= threads;
+    std::vector<RenderContext*> free_contexts{};
+    std::size_t contexts_made = view_per_thread ? threads : cameras.size();
+    for (std::size_t i = contexts_made; i-- > 0;) {
+        free_contexts.push_back(&context.view(i));
+    }
+    std::mutex free_mutex{};
+    auto claim = [&]() -> RenderContext& {
+        const std::lock_guard lock{free_mutex};
+        if (free_contexts.empty()) {
+            return context.view(contexts_made++);
+        }
+        RenderContext* claimed = free_contexts.back();
+        free_contexts.pop_back();
+        return *claimed;
+    };
+    auto release = [&](RenderContext& released) {
+        const std::lock_guard lock{free_mutex};
+        free_contexts.push_back(&released);
+    };
+
+    PipelineState view_state = state;
+    view_state.parallelize = !view_per_thread;
+
+    async_for(pool, state.parallelize, 0, cameras.size(), [&](std::size_t i) {
+        RenderContext& view_context = view_per_thread ? claim() : context.view(i);
+        try {
+            draw_scene(view_context, scene, needs_normals ? &world_normals : nullptr, cameras[i], frame_buffers[i],
+                       view_state, stats.empty() ? nullptr : &stats[i]);
+        } catch (...) {
+            if (view_per_thread) {
+                release(view_context);
+            }
+            throw;
+        }
+        if (view_per_thread) {
+            release(view_context);
+        }
+    });
+
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw(RenderContext& context, const std::vector<Object>& objects, const Camera& camera,
+                    FrameBuffer& frame_buffer, const PipelineState& state, RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+    draw_objects(context, objects, camera, frame_buffer, state, stats);
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw(RenderContext& context, const MeshStream& mesh, const Camera& camera, FrameBuffer& frame_buffer,
+                    const PipelineState& state, RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+
+    const Clock::time_point start = Clock::now();
+    RenderStats local_stats{};
+    stats = begin_stats(stats, local_stats, context.pool());
+    ZBuffer& z_buffer = context.cleared_z_buffer(frame_buffer.width(), frame_buffer.height());
+
     float aspect_ratio = static_cast<float>(frame_buffer.width()) / static_cast<float>(frame_buffer.height());
+    const Matrix4x4f projection = camera.projection_matrix(aspect_ratio);
+    const Matrix4x4f model_view = camera.view_matrix();
+
+    // Chunks out of view are never read at all
+    std::vector<std::size_t> visible{};
+    for (std::size_t i = 0; i < mesh.chunk_count(); ++i) {
+        if (!outside_frustum(mesh.chunk_bounds(i), projection * model_view)) {
+            visible.push_back(i);
+        }
+    }
 
-    for (const auto& object : objects) {
-        // 1. Transform to view space
-        std::vector<Vec4f> view_space_vertices =
-            to_view_space(object.vertices(), object.transform_matrix(), camera.view_matrix());
-        // 2. Transform to normalized device coordinates (NDC)
-        std::vector<Vec3f> ndc_vertices =
-            apply_vertex_shader(view_space_vertices, camera.projection_matrix(aspect_ratio));
-
-        auto task = [&](std::size_t i) {
-            const auto& face = object.faces()[i];
-
-            // Get the vertices of the triangle in view space
-            Vec3f v0_view{view_space_vertices[face[0]]};
-            Vec3f v1_view{view_space_vertices[face[1]]};
-            Vec3f v2_view{view_space_vertices[face[2]]};
-
-            // Calculate the normal of the face
-            // TODO: Figure out why this only works when flipped
-            Vec3f normal = (v1_view - v0_view).cross(v2_view - v0_view) * -1.f;
-
-            // TODO: Make global option
-            constexpr bool cull_backfaces = false;
-            if (cull_backfaces && normal.z() <= 0.f) {
-                // Cull the backface
-                return;
+    // Reads of the chunks after the one being drawn, oldest first
+    ThreadPool& pool = context.pool();
+    std::deque<std::future<Object>> reads{};
+    std::size_t next_read = 0;
+    auto read_ahead = [&](std::size_t in_flight) {
+        while (next_read < visible.size() && reads.size() < in_flight) {
+            reads.push_back(pool.submit([&mesh, index = visible[next_read]]() { return mesh.read_chunk(index); }));
+            ++next_read;
+        }
+    };
+
+    try {
+        read_ahead(mesh.chunks_in_flight());
+        for (std::size_t i = 0; i < visible.size(); ++i) {
+            // With a single chunk in flight, the next one is only read once the one before it has been drawn
+            read_ahead(1);
+            // Taken off the queue before it is waited on, so that the queue only ever holds reads still to be waited on
+            std::future<Object> read = std::move(reads.front());
+            reads.pop_front();
+            // The read may be queued behind this very draw, when it runs on one of the pool's workers
+            pool.wait(read);
+            const Object chunk = read.get();
+            // The chunk being drawn is one of those in flight
+            read_ahead(mesh.chunks_in_flight() - 1);
+
+            draw_object(chunk, nullptr, nullptr, nullptr, model_view, projection, frame_buffer, context, state,
+                        i + 1 < visible.size(), stats);
+        }
+    } catch (...) {
+        // The reads still running refer to the mesh - their own errors are dropped in favour of the first one
+        for (auto& read : reads) {
+            if (read.valid()) {
+                pool.wait(read);
             }
+        }
+        throw;
+    }
 
-            switch (mode) {
-                case Mode::Wireframe: {
+    if (stats) {
+        stats->objects_submitted = mesh.chunk_count();
+        stats->objects_culled = mesh.chunk_count() - visible.size();
+    }
+    end_stats(stats, z_buffer, start);
 
-                    Color3 color = Colors::white;
-                    draw_triangle(ndc_vertices[face[0]], ndc_vertices[face[1]], ndc_vertices[face[2]], frame_buffer,
-                                  color);
-                    break;
-                }
-                case Mode::Shaded: {
-                    Vec3f unit_normal = normal.unit();
-
-                    // Calculate the light intensity based on the angle between the normal and the light direction
-                    Vec3f light_direction = Vec3f{1.f, 1.f, 1.f}.unit(); // Light points into the screen
-                    const float intensity = std::max(0.01f, unit_normal.dot(light_direction)); // Some ambient light
-
-                    // Use the intensity to shade the color
-                    Color3 color = {intensity, intensity, intensity};
-                    draw_triangle_filled(ndc_vertices[face[0]], ndc_vertices[face[1]], ndc_vertices[face[2]],
-                                         frame_buffer, z_buffer, color);
-                    break;
-                }
-                case Mode::Normals: {
-                    Vec3f unit_normal = normal.unit();
+    PROFILE_FRAME_END("Renderer::draw");
+}
 
-                    float r = std::abs(unit_normal.x());
-                    float g = std::abs(unit_normal.y());
-                    float b = std::abs(unit_normal.z());
+void Renderer::draw_instanced(RenderContext& context, const Object& mesh, std::span<const Transform> instances,
+                              const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                              RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+
+    // Every matrix is built once, in one batch, before any instance is looked at
+    std::vector<Matrix4x4f>& models = context.instances().models;
+    models.resize(instances.size());
+    {
+        PROFILE_STAGE("Instance matrices");
+        async_for(
+            context.pool(), state.parallelize, 0, instances.size(),
+            [&](std::size_t i) { models[i] = instances[i].matrix(); }, 1024);
+    }
+    draw_instances(context, mesh, models, camera, frame_buffer, state, stats);
 
-                    Color3 color{r, g, b};
-                    draw_triangle_filled(ndc_vertices[face[0]], ndc_vertices[face[1]], ndc_vertices[face[2]],
-                                         frame_buffer, z_buffer, color);
-                    break;
-                }
-                default: {
-                    throw std::invalid_argument("Invalid renderer mode");
-                }
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw_instanced(RenderContext& context, const Object& mesh, std::span<const Matrix4x4f> instances,
+                              const Camera& camera, FrameBuffer& frame_buffer, const PipelineState& state,
+                              RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+    draw_instances(context, mesh, instances, camera, frame_buffer, state, stats);
+    PROFILE_FRAME_END("Renderer::draw");
+}
+
+void Renderer::draw_incremental(const std::vector<Object>& objects, std::span<const std::size_t> changed,
+                                const Camera& camera, FrameBuffer& frame_buffer, const Color3& background,
+                                const PipelineState& state, RenderStats* stats) {
+    draw_incremental(*RenderContext::for_this_thread(), objects, changed, camera, frame_buffer, background, state,
+                     stats);
+}
+
+void Renderer::draw_incremental(RenderContext& context, const std::vector<Object>& objects,
+                                std::span<const std::size_t> changed, const Camera& camera, FrameBuffer& frame_buffer,
+                                const Color3& background, const PipelineState& state, RenderStats* stats) {
+    PROFILE_FRAME_START("Renderer::draw");
+
+    const Clock::time_point start = Clock::now();
+    RenderStats local_stats{};
+    stats = begin_stats(stats, local_stats, context.pool());
+
+    const int width = frame_buffer.width();
+    const int height = frame_buffer.height();
+    const float aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
+    const Matrix4x4f projection = camera.projection_matrix(aspect_ratio);
+    const Matrix4x4f view = camera.view_matrix();
+
+    // Where every object may draw to this time
+    std::vector<Rect2i> object_rects(objects.size());
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        object_rects[i] = screen_rect(objects[i].bounds(), projection * view * objects[i].transform_matrix(), width,
+                                      height);
+    }
+
+    // Anything else that changed since the last frame means starting over
+    RenderContext::History& history = context.history();
+    const bool redraw_all = !history.valid || history.target != &frame_buffer || history.view != view ||
+                            history.projection != projection || history.state != state ||
+                            history.object_rects.size() != objects.size() ||
+                            context.z_buffer().width() != width || context.z_buffer().height() != height;
+
+    // The tiles that the changed objects covered last time or cover now, which are cleared and drawn over again
+    TileBinner& binner = context.binner();
+    binner.reset(width, height, 1);
+    const int tiles_x = (width + TileBinner::tile_size - 1) / TileBinner::tile_size;
+    auto for_each_tile = [&](const Rect2i& rect, auto&& func) {
+        if (rect.empty()) {
+            return;
+        }
+        for (int ty = rect.min.y() / TileBinner::tile_size; ty <= (rect.max.y() - 1) / TileBinner::tile_size; ++ty) {
+            for (int tx = rect.min.x() / TileBinner::tile_size; tx <= (rect.max.x() - 1) / TileBinner::tile_size;
+                 ++tx) {
+                func(static_cast<std::uint32_t>(ty * tiles_x + tx));
             }
-        };
+        }
+    };
+
+    std::vector<std::uint8_t>& dirty = history.dirty;
+    std::vector<std::uint32_t>& dirty_tiles = history.dirty_tiles;
+    dirty.assign(binner.tile_count(), 0);
+    dirty_tiles.clear();
+    if (redraw_all) {
+        frame_buffer.clear(background);
+        context.cleared_z_buffer(width, height);
+    } else {
+        for (const std::size_t index : changed) {
+            if (index >= objects.size()) {
+                throw std::out_of_range("Changed object " + std::to_string(index) + " is not one of the " +
+                                        std::to_string(objects.size()) + " objects");
+            }
+            auto mark = [&](std::uint32_t tile) {
+                if (!dirty[tile]) {
+                    dirty[tile] = 1;
+                    dirty_tiles.push_back(tile);
+                }
+            };
+            for_each_tile(history.object_rects[index], mark);
+            for_each_tile(object_rects[index], mark);
+        }
+
+        ZBuffer& z_buffer = context.z_buffer();
+        async_for(context.pool(), state.parallelize, 0, dirty_tiles.size(), [&](std::size_t i) {
+            const Rect2i tile = binner.tile_rect(static_cast<int>(dirty_tiles[i]));
+            frame_buffer.clear(tile, background);
+            z_buffer.clear(tile);
+        });
+    }
 
-        async_for(0, object.faces().size(), task);
+    // Every object that reaches into those tiles is drawn again, in the same order as before, so each tile ends up
+    // just like it would from a full draw
+    std::uint64_t objects_drawn = 0;
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        bool touches_dirty = redraw_all;
+        for_each_tile(object_rects[i], [&](std::uint32_t tile) { touches_dirty = touches_dirty || dirty[tile]; });
+        if (object_rects[i].empty() || !touches_dirty) {
+            continue;
+        }
+
+        const Matrix4x4f model_view = view * objects[i].transform_matrix();
+        draw_object(objects[i], nullptr, nullptr, redraw_all ? nullptr : &dirty_tiles, model_view, projection,
+                    frame_buffer, context, state, true, stats);
+        ++objects_drawn;
     }
 
-    FrameMarkEnd("Renderer::draw");
-}
\ No newline at end of file
+    history.valid = true;
+    history.target = &frame_buffer;
+    history.view = view;
+    history.projection = projection;
+    history.state = state;
+    history.object_rects = std::move(object_rects);
+
+    if (stats) {
+        stats->objects_submitted = objects.size();
+        stats->objects_culled = objects.size() - objects_drawn;
+    }
+    end_stats(stats, context.z_buffer(), start);
+
+    PROFILE_FRAME_END("Renderer::draw");
+}
@@ -0,0 +1,51 @@
+#include "scene.hpp" // self
+#include "utils/profiling.hpp"
+
+namespace {
+
+// The box around a box once it has been transformed
+Bounds3f transform_bounds(const Bounds3f& bounds, const Matrix4x4f& matrix) {
+    Bounds3f transformed{};
+    if (bounds.empty()) {
+        return transformed;
+    }
+
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec4f point{corner & 1 ? bounds.max.x() : bounds.min.x(), corner & 2 ? bounds.max.y() : bounds.min.y(),
+                          corner & 4 ? bounds.max.z() : bounds.min.z(), 1.f};
+        transformed.add(Vec3f{matrix.row(0).dot(point), matrix.row(1).dot(point), matrix.row(2).dot(point)});
+    }
+    return transformed;
+}
+
+} // namespace
+
+std::size_t Scene::add(Object object) {
+    m_objects.push_back(std::move(object));
+    return m_objects.size() - 1;
+}
+
+void Scene::build() {
+    PROFILE_STAGE("Scene::build"); // Add Tracy profiling for this function
+
+    // Objects keep their face hierarchies between builds - only the new ones need one
+    m_face_bvhs.reserve(m_objects.size());
+    for (std::size_t i = m_face_bvhs.size(); i < m_objects.size(); ++i) {
+        const auto faces = m_objects[i].faces();
+        const auto vertices = m_objects[i].vertices();
+
+        std::vector<Bounds3f> face_bounds(faces.size());
+        for (std::size_t face = 0; face < faces.size(); ++face) {
+            for (const int vertex : faces[face]) {
+                face_bounds[face].add(vertices[vertex]);
+            }
+        }
+        m_face_bvhs.emplace_back(face_bounds, cluster_size);
+    }
+
+    std::vector<Bounds3f> object_bounds(m_objects.size());
+    for (std::size_t i = 0; i < m_objects.size(); ++i) {
+        object_bounds[i] = transform_bounds(m_objects[i].bounds(), m_objects[i].transform_matrix());
+    }
+    m_object_bvh = Bvh{object_bounds};
+}
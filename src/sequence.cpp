@@ -0,0 +1,103 @@
+#include "sequence.hpp" // self
+#include "renderer.hpp"
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
+#include "utils/video_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+#include <utility>
+
+void Sequence::render(std::vector<Object> objects, Camera camera, const Settings& settings, const Animation& animate,
+                      const Sink& sink) {
+    PROFILE_STAGE("Sequence::render"); // Add Tracy profiling for this function
+
+    if (settings.frame_count <= 0) {
+        return;
+    }
+
+    std::array<FrameBuffer, 2> frame_buffers{
+        FrameBuffer{settings.width, settings.height, settings.background, settings.format},
+        FrameBuffer{settings.width, settings.height, settings.background, settings.format},
+    };
+
+    // The sink call for the frame before the one being drawn
+    std::future<void> pending{};
+
+    try {
+        for (int frame = 0; frame < settings.frame_count; ++frame) {
+            // Frame - 2 was the last one drawn into this buffer, and the sink was done with it before frame - 1 went
+            FrameBuffer& frame_buffer = frame_buffers[frame % 2];
+
+            if (animate) {
+                animate(frame, camera, objects);
+            }
+            if (frame >= 2) {
+                frame_buffer.clear(settings.background);
+            }
+            Renderer::draw(objects, camera, frame_buffer, settings.state);
+
+            // Keeps the frames in order, and only ever one of them with the sink
+            if (pending.valid()) {
+                pending.get();
+            }
+            pending = ThreadPool::global().submit([&sink, &frame_buffer, frame]() { sink(frame, frame_buffer); });
+        }
+        pending.get();
+    } catch (...) {
+        // The sink may still be reading one of the frame buffers
+        if (pending.valid()) {
+            pending.wait();
+        }
+        throw;
+    }
+}
+
+Sequence::Animation Sequence::turntable(const Vec3f& target, float radius, float height, int frame_count) {
+    return [=](int frame, Camera& camera, std::vector<Object>&) {
+        const float angle = 2.f * std::numbers::pi_v<float> * static_cast<float>(frame) /
+                            static_cast<float>(std::max(frame_count, 1));
+        // Frame 0 looks down +z, like the default camera
+        camera.set_position(target + Vec3f{radius * std::sin(angle), height, -radius * std::cos(angle)});
+        camera.set_target(target);
+    };
+}
+
+Sequence::Sink Sequence::image_files(std::string pattern) {
+    return [pattern = std::move(pattern)](int frame, const FrameBuffer& frame_buffer) {
+        const int length = std::snprintf(nullptr, 0, pattern.c_str(), frame);
+        if (length < 0) {
+            throw std::runtime_error("Could not format the frame number into " + pattern);
+        }
+        std::string name(static_cast<std::size_t>(length), '\0');
+        std::snprintf(name.data(), name.size() + 1, pattern.c_str(), frame);
+
+        const std::filesystem::path filename{name};
+        if (filename.has_parent_path()) {
+            std::filesystem::create_directories(filename.parent_path());
+        }
+        frame_buffer.write(filename.string());
+    };
+}
+
+Sequence::Sink Sequence::video_stream(const std::string& filename, int width, int height, int frames_per_second) {
+    const std::filesystem::path path{filename};
+    if (filename != "-" && path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+    // Opened up front, so that a bad path is reported before anything is drawn
+    auto writer = std::make_shared<Y4mWriter>(filename, width, height, frames_per_second);
+    return [writer](int, const FrameBuffer& frame_buffer) {
+        if (frame_buffer.width() != writer->width() || frame_buffer.height() != writer->height()) {
+            throw std::invalid_argument("Frame size doesn't match the video");
+        }
+        writer->write_frame(frame_buffer.to_yuv420());
+    };
+}
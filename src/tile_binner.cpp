@@ -0,0 +1,40 @@
+#include "tile_binner.hpp" // self
+
+void TileBinner::reset(int width, int height, std::size_t num_streams) {
+    m_width = width;
+    m_height = height;
+    m_tiles_x = (width + tile_size - 1) / tile_size;
+    m_tiles_y = (height + tile_size - 1) / tile_size;
+    m_num_streams = num_streams;
+
+    m_bins.resize(m_num_streams * tile_count());
+    for (auto& bin : m_bins) {
+        bin.clear();
+    }
+}
+
+void TileBinner::bin(std::size_t stream, std::uint32_t id, const Rect2i& bounds) {
+    Rect2i clipped = bounds.intersect({{0, 0}, {m_width, m_height}});
+    if (clipped.empty()) {
+        return;
+    }
+
+    const int first_x = clipped.min.x() / tile_size;
+    const int last_x = (clipped.max.x() - 1) / tile_size;
+    const int first_y = clipped.min.y() / tile_size;
+    const int last_y = (clipped.max.y() - 1) / tile_size;
+
+    auto* stream_bins = &m_bins[stream * tile_count()];
+    for (int ty = first_y; ty <= last_y; ++ty) {
+        for (int tx = first_x; tx <= last_x; ++tx) {
+            stream_bins[ty * m_tiles_x + tx].push_back(id);
+        }
+    }
+}
+
+Rect2i TileBinner::tile_rect(int tile) const {
+    const int tx = tile % m_tiles_x;
+    const int ty = tile / m_tiles_x;
+    Rect2i rect{{tx * tile_size, ty * tile_size}, {(tx + 1) * tile_size, (ty + 1) * tile_size}};
+    return rect.intersect({{0, 0}, {m_width, m_height}});
+}
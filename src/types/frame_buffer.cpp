@@ -1,39 +1,462 @@
-#include "types/frame_buffer.hpp"
+#include "types/frame_buffer.hpp" // self
+#include "utils/image_writer.hpp"
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb/stb_image_write.h>
+#include <xsimd/xsimd.hpp> // SIMD batches
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <numeric> // std::iota
+#include <stdexcept>
+#include <utility> // std::pair
 
-FrameBuffer::FrameBuffer(int width, int height, const Color3& color)
-    : m_width{width}, m_height{height}, m_buffer_ptr{std::make_shared<std::vector<Color3>>(width * height, color)} {}
+namespace {
+
+std::size_t bytes_per_pixel(FrameBuffer::Format format) {
+    switch (format) {
+        case FrameBuffer::Format::RGB32F: return 3 * sizeof(float);
+        case FrameBuffer::Format::RGBA8_SRGB: return 4;
+        case FrameBuffer::Format::RGB10A2: return 4;
+        case FrameBuffer::Format::RGBA16F: return 4 * sizeof(std::uint16_t);
+        default: throw std::invalid_argument("Invalid frame buffer format");
+    }
+}
+
+float saturate(float value) { return std::clamp(value, 0.f, 1.f); }
+
+float linear_to_srgb(float value) {
+    value = saturate(value);
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+}
+
+float srgb_to_linear(float value) {
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Decoding an 8-bit sRGB channel is just a lookup
+const std::array<float, 256>& srgb_decode_table() {
+    static const std::array<float, 256> table = []() {
+        std::array<float, 256> result{};
+        for (std::size_t i = 0; i < result.size(); ++i) {
+            result[i] = srgb_to_linear(static_cast<float>(i) / 255.f);
+        }
+        return result;
+    }();
+    return table;
+}
+
+// IEEE 754 binary16, rounding to nearest even - values too large for a half become infinity
+std::uint16_t float_to_half(float value) {
+    const std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+    const std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    const std::uint32_t magnitude = bits & 0x7fffffffu;
+
+    if (magnitude >= 0x7f800000u) {
+        // Infinity stays infinity, NaN stays a (quiet) NaN
+        return sign | (magnitude > 0x7f800000u ? 0x7e00u : 0x7c00u);
+    }
+    if (magnitude >= 0x477ff000u) {
+        // Rounds up past the largest half
+        return sign | 0x7c00u;
+    }
+    if (magnitude < 0x38800000u) {
+        // Subnormal half (or zero) - let the float hardware do the rounding by adding in a fixed exponent
+        const float subnormal = std::bit_cast<float>(magnitude) + 0.5f;
+        return sign | static_cast<std::uint16_t>(std::bit_cast<std::uint32_t>(subnormal) - 0x3f000000u);
+    }
+
+    // Re-bias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+    const std::uint32_t odd = (magnitude >> 13) & 1u;
+    const std::uint32_t rounded = magnitude + 0xc8000fffu + odd;
+    return sign | static_cast<std::uint16_t>(rounded >> 13);
+}
+
+float half_to_float(std::uint16_t half) {
+    const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+    const std::uint32_t exponent = (half >> 10) & 0x1fu;
+    const std::uint32_t mantissa = half & 0x3ffu;
+
+    if (exponent == 0) {
+        // Zero or subnormal
+        const float value = static_cast<float>(mantissa) * (1.f / 16777216.f); // 2^-24
+        return std::bit_cast<float>(std::bit_cast<std::uint32_t>(value) | sign);
+    }
+    if (exponent == 0x1f) {
+        return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// Gamma corrects and quantizes linear colors to 8 bits, giving the same results as
+// `static_cast<std::uint8_t>(std::pow(value, 1.0f / 2.2f) * 255)` for values in [0, 1] but without calling pow. The
+// top bits of a float pick an entry in a coarse table that is at most one step below the answer, and the exact
+// thresholds between neighbouring outputs fix up the rest. Values outside of [0, 1] (and NaN) are clamped
+class GammaEncoder {
+public:
+    GammaEncoder() {
+        // The smallest value that encodes to each output, found by bisecting over the bit patterns of [0, 1]
+        const auto reference = [](std::uint32_t bits) {
+            const float gamma = 2.2f;
+            return static_cast<int>(std::pow(std::bit_cast<float>(bits), 1.0f / gamma) * 255);
+        };
+        m_thresholds[0] = 0.f;
+        for (int code = 1; code < 256; ++code) {
+            std::uint32_t low = 0;
+            std::uint32_t high = std::bit_cast<std::uint32_t>(1.f);
+            while (low < high) {
+                const std::uint32_t middle = low + (high - low) / 2;
+                if (reference(middle) >= code) {
+                    high = middle;
+                } else {
+                    low = middle + 1;
+                }
+            }
+            m_thresholds[code] = std::bit_cast<float>(low);
+        }
+        m_thresholds[256] = std::numeric_limits<float>::infinity();
+
+        const int bucket_count = (std::bit_cast<std::int32_t>(1.f) >> bucket_shift) - bucket_base + 1;
+        m_coarse.resize(bucket_count);
+        for (int bucket = 0; bucket < bucket_count; ++bucket) {
+            // Everything below the first bucket is squashed into it too
+            const float start = bucket == 0 ? 0.f : std::bit_cast<float>((bucket + bucket_base) << bucket_shift);
+            int code = 0;
+            while (m_thresholds[code + 1] <= start) {
+                ++code;
+            }
+            m_coarse[bucket] = static_cast<std::uint8_t>(code);
+        }
+    }
+
+    std::uint8_t operator()(float value) const {
+        value = value > 0.f ? std::min(value, 1.f) : 0.f;
+        return encode_clamped(value, std::max((std::bit_cast<std::int32_t>(value) >> bucket_shift) - bucket_base, 0));
+    }
+
+    void encode(const float* values, std::size_t count, std::uint8_t* out) const {
+        using FloatBatch = xsimd::batch<float>;
+        using IntBatch = xsimd::batch<std::int32_t>;
+        constexpr std::size_t lanes = FloatBatch::size;
+
+        std::size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            FloatBatch value = FloatBatch::load_unaligned(values + i);
+            value = xsimd::min(xsimd::select(value > 0.f, value, FloatBatch(0.f)), FloatBatch(1.f));
+            const IntBatch bucket =
+                xsimd::max((xsimd::bitwise_cast<std::int32_t>(value) >> bucket_shift) - bucket_base, IntBatch(0));
+
+            std::array<float, lanes> clamped{};
+            std::array<std::int32_t, lanes> buckets{};
+            value.store_unaligned(clamped.data());
+            bucket.store_unaligned(buckets.data());
+            for (std::size_t lane = 0; lane < lanes; ++lane) {
+                out[i + lane] = encode_clamped(clamped[lane], buckets[lane]);
+            }
+        }
+        for (; i < count; ++i) {
+            out[i] = (*this)(values[i]);
+        }
+    }
+
+private:
+    // Buckets hold 2^12 floats each, narrow enough that no bucket spans more than one threshold. Everything below
+    // 2^-18 encodes to 0
+    static constexpr int bucket_shift = 12;
+    static constexpr int bucket_base = std::bit_cast<std::int32_t>(0x1p-18f) >> bucket_shift;
+
+    std::array<float, 257> m_thresholds{};
+    std::vector<std::uint8_t> m_coarse{};
+
+    std::uint8_t encode_clamped(float value, std::int32_t bucket) const {
+        const std::uint8_t code = m_coarse[bucket];
+        return code + (value >= m_thresholds[code + 1] ? 1 : 0);
+    }
+};
+
+const GammaEncoder& gamma_encoder() {
+    static const GammaEncoder encoder{};
+    return encoder;
+}
+
+// BT.601 limited range, in 8-bit fixed point. Works on plain ints and on SIMD batches of them alike
+template <typename T> T luma(const T& r, const T& g, const T& b) {
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+// The chroma of a 2x2 block, from the sums of its 4 pixels' channels - scaled by 4 to fold the averaging in
+template <typename T> T chroma_u(const T& r, const T& g, const T& b) {
+    return ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+}
+template <typename T> T chroma_v(const T& r, const T& g, const T& b) {
+    return ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+}
+
+// Converts a pair of 8-bit RGB rows into their two rows of luma and one row of each chroma. Past the right edge of an
+// odd width, the last column is repeated
+void rgb8_to_yuv420_rows(const std::uint8_t* top, const std::uint8_t* bottom, int width, std::uint8_t* y_top,
+                         std::uint8_t* y_bottom, std::uint8_t* u, std::uint8_t* v) {
+    using IntBatch = xsimd::batch<std::int32_t>;
+    constexpr int lanes = static_cast<int>(IntBatch::size);
+
+    // Every lane is a group of 4 pixels, which are exactly 3 words of RGB - the words are gathered, and every channel
+    // shifted out of the word it is in
+    std::array<std::int32_t, lanes> lane_indices{};
+    std::iota(lane_indices.begin(), lane_indices.end(), 0);
+    const IntBatch group_offsets = IntBatch::load_unaligned(lane_indices.data()) * 3;
+    const auto channel = [](const std::array<IntBatch, 3>& words, int pixel, int offset) {
+        const int byte = pixel * 3 + offset;
+        return (words[byte / 4] >> (byte % 4 * 8)) & 0xff;
+    };
+
+    // Puts the values for the pixels (or blocks) of each group back in the order of the row, narrowing them to bytes
+    const auto store_pairs = [](const IntBatch& left, const IntBatch& right, std::uint8_t* out) {
+        xsimd::zip_lo(left, right).store_unaligned(out);
+        xsimd::zip_hi(left, right).store_unaligned(out + lanes);
+    };
+    const auto store_quads = [&](const std::array<IntBatch, 4>& pixels, std::uint8_t* out) {
+        store_pairs(xsimd::zip_lo(pixels[0], pixels[2]), xsimd::zip_lo(pixels[1], pixels[3]), out);
+        store_pairs(xsimd::zip_hi(pixels[0], pixels[2]), xsimd::zip_hi(pixels[1], pixels[3]), out + 2 * lanes);
+    };
+
+    const int chroma_width = (width + 1) / 2;
+    int block = 0;
+    for (; (block + 2 * lanes) * 2 <= width; block += 2 * lanes) {
+        const int x = block * 2;
+
+        // The sums for the left and right block of every group
+        std::array<IntBatch, 2> r_sum{IntBatch{0}, IntBatch{0}};
+        std::array<IntBatch, 2> g_sum{IntBatch{0}, IntBatch{0}};
+        std::array<IntBatch, 2> b_sum{IntBatch{0}, IntBatch{0}};
+        for (const auto& [row, out] : {std::pair{top, y_top}, std::pair{bottom, y_bottom}}) {
+            const auto* row_words = reinterpret_cast<const std::int32_t*>(row + x * 3);
+            std::array<IntBatch, 3> words{};
+            for (int i = 0; i < 3; ++i) {
+                words[i] = IntBatch::gather(row_words, group_offsets + i);
+            }
+
+            std::array<IntBatch, 4> luma_out{};
+            for (int pixel = 0; pixel < 4; ++pixel) {
+                const IntBatch r = channel(words, pixel, 0);
+                const IntBatch g = channel(words, pixel, 1);
+                const IntBatch b = channel(words, pixel, 2);
+                luma_out[pixel] = luma(r, g, b);
+                r_sum[pixel / 2] += r;
+                g_sum[pixel / 2] += g;
+                b_sum[pixel / 2] += b;
+            }
+            store_quads(luma_out, out + x);
+        }
+
+        store_pairs(chroma_u(r_sum[0], g_sum[0], b_sum[0]), chroma_u(r_sum[1], g_sum[1], b_sum[1]), u + block);
+        store_pairs(chroma_v(r_sum[0], g_sum[0], b_sum[0]), chroma_v(r_sum[1], g_sum[1], b_sum[1]), v + block);
+    }
+
+    for (; block < chroma_width; ++block) {
+        int r_sum = 0;
+        int g_sum = 0;
+        int b_sum = 0;
+        for (int column = 0; column < 2; ++column) {
+            const int x = std::min(block * 2 + column, width - 1);
+            for (const std::uint8_t* row : {top, bottom}) {
+                r_sum += row[x * 3];
+                g_sum += row[x * 3 + 1];
+                b_sum += row[x * 3 + 2];
+            }
+            if (block * 2 + column < width) {
+                y_top[x] = static_cast<std::uint8_t>(luma<int>(top[x * 3], top[x * 3 + 1], top[x * 3 + 2]));
+                y_bottom[x] =
+                    static_cast<std::uint8_t>(luma<int>(bottom[x * 3], bottom[x * 3 + 1], bottom[x * 3 + 2]));
+            }
+        }
+        u[block] = static_cast<std::uint8_t>(chroma_u(r_sum, g_sum, b_sum));
+        v[block] = static_cast<std::uint8_t>(chroma_v(r_sum, g_sum, b_sum));
+    }
+}
+
+} // namespace
+
+FrameBuffer::FrameBuffer(int width, int height, const Color3& color, Format format)
+    : m_width{width}, m_height{height}, m_format{format}, m_bytes_per_pixel{::bytes_per_pixel(format)},
+      m_buffer_ptr{std::make_shared<std::vector<std::byte>>(static_cast<std::size_t>(width) * height *
+                                                            m_bytes_per_pixel)} {
+    clear(color);
+}
+
+void FrameBuffer::clear(const Color3& color) { clear({{0, 0}, {m_width, m_height}}, color); }
+
+void FrameBuffer::clear(const Rect2i& region, const Color3& color) {
+    const Rect2i pixels = region.intersect({{0, 0}, {m_width, m_height}});
+    const PackedColor packed = pack(color);
+    for (int y = pixels.min.y(); y < pixels.max.y(); ++y) {
+        for (int x = pixels.min.x(); x < pixels.max.x(); ++x) {
+            store(x, y, packed);
+        }
+    }
+}
+
+FrameBuffer::PackedColor FrameBuffer::pack(const Color3& color) const {
+    PackedColor packed{};
+    switch (m_format) {
+        case Format::RGB32F: {
+            std::memcpy(packed.bytes.data(), &color[0], 3 * sizeof(float));
+            break;
+        }
+        case Format::RGBA8_SRGB: {
+            const std::array<std::uint8_t, 4> channels{
+                static_cast<std::uint8_t>(std::lround(linear_to_srgb(color.r()) * 255.f)),
+                static_cast<std::uint8_t>(std::lround(linear_to_srgb(color.g()) * 255.f)),
+                static_cast<std::uint8_t>(std::lround(linear_to_srgb(color.b()) * 255.f)),
+                255,
+            };
+            std::memcpy(packed.bytes.data(), channels.data(), channels.size());
+            break;
+        }
+        case Format::RGB10A2: {
+            const std::uint32_t r = static_cast<std::uint32_t>(std::lround(saturate(color.r()) * 1023.f));
+            const std::uint32_t g = static_cast<std::uint32_t>(std::lround(saturate(color.g()) * 1023.f));
+            const std::uint32_t b = static_cast<std::uint32_t>(std::lround(saturate(color.b()) * 1023.f));
+            const std::uint32_t value = r | (g << 10) | (b << 20) | (3u << 30);
+            std::memcpy(packed.bytes.data(), &value, sizeof(value));
+            break;
+        }
+        case Format::RGBA16F: {
+            const std::array<std::uint16_t, 4> channels{float_to_half(color.r()), float_to_half(color.g()),
+                                                        float_to_half(color.b()), float_to_half(1.f)};
+            std::memcpy(packed.bytes.data(), channels.data(), sizeof(channels));
+            break;
+        }
+    }
+    return packed;
+}
+
+Color3 FrameBuffer::unpack(const std::byte* pixel) const {
+    switch (m_format) {
+        case Format::RGB32F: {
+            Color3 color{};
+            std::memcpy(&color[0], pixel, 3 * sizeof(float));
+            return color;
+        }
+        case Format::RGBA8_SRGB: {
+            const auto& table = srgb_decode_table();
+            return {table[std::to_integer<std::uint8_t>(pixel[0])], table[std::to_integer<std::uint8_t>(pixel[1])],
+                    table[std::to_integer<std::uint8_t>(pixel[2])]};
+        }
+        case Format::RGB10A2: {
+            std::uint32_t value = 0;
+            std::memcpy(&value, pixel, sizeof(value));
+            return {static_cast<float>(value & 0x3ffu) / 1023.f, static_cast<float>((value >> 10) & 0x3ffu) / 1023.f,
+                    static_cast<float>((value >> 20) & 0x3ffu) / 1023.f};
+        }
+        case Format::RGBA16F: {
+            std::array<std::uint16_t, 4> channels{};
+            std::memcpy(channels.data(), pixel, sizeof(channels));
+            return {half_to_float(channels[0]), half_to_float(channels[1]), half_to_float(channels[2])};
+        }
+        default: throw std::invalid_argument("Invalid frame buffer format");
+    }
+}
 
 FrameBuffer FrameBuffer::clone() const {
-    FrameBuffer clone{m_width, m_height};
-    clone.m_buffer_ptr = std::make_shared<std::vector<Color3>>(*m_buffer_ptr);
+    FrameBuffer clone{m_width, m_height, Colors::black, m_format};
+    clone.m_buffer_ptr = std::make_shared<std::vector<std::byte>>(*m_buffer_ptr);
     return clone;
 }
 
-void FrameBuffer::write(const std::string& filename) {
-    // TODO: Refactor
-    std::vector<std::uint8_t> data(m_width * m_height * 4);
-    for (int y = 0; y < m_height; ++y) {
-        for (int x = 0; x < m_width; ++x) {
-            Color3& color = (*this)[x, y]; // Get the color at the pixel coordinate
-            // Perform gamma correction
-            float gamma = 2.2f;
-            color.r() = std::pow(color.r(), 1.0f / gamma);
-            color.g() = std::pow(color.g(), 1.0f / gamma);
-            color.b() = std::pow(color.b(), 1.0f / gamma);
+std::vector<std::uint8_t> FrameBuffer::to_rgb8() const {
+    PROFILE_STAGE("FrameBuffer::to_rgb8"); // Add Tracy profiling for this function
+
+    const std::size_t row_size = static_cast<std::size_t>(m_width) * 3;
+    std::vector<std::uint8_t> data(row_size * m_height);
+
+    ThreadPool::global().parallel_for(
+        0, m_height, [&](std::size_t y) { row_to_rgb8(static_cast<int>(y), data.data() + y * row_size); }, 16);
+
+    return data;
+}
+
+std::vector<std::uint8_t> FrameBuffer::to_yuv420() const {
+    PROFILE_STAGE("FrameBuffer::to_yuv420"); // Add Tracy profiling for this function
 
-            // Convert the 32-bit color to 8-bit color depth
-            data[(y * m_width + x) * 4 + 0] = static_cast<std::uint8_t>(color.r() * 255);
-            data[(y * m_width + x) * 4 + 1] = static_cast<std::uint8_t>(color.g() * 255);
-            data[(y * m_width + x) * 4 + 2] = static_cast<std::uint8_t>(color.b() * 255);
-            data[(y * m_width + x) * 4 + 3] = static_cast<std::uint8_t>(1.0f * 255);
+    const std::size_t luma_size = static_cast<std::size_t>(m_width) * m_height;
+    const int chroma_width = (m_width + 1) / 2;
+    const int chroma_height = (m_height + 1) / 2;
+    const std::size_t chroma_size = static_cast<std::size_t>(chroma_width) * chroma_height;
+    std::vector<std::uint8_t> data(luma_size + 2 * chroma_size);
+
+    std::uint8_t* const y_plane = data.data();
+    std::uint8_t* const u_plane = y_plane + luma_size;
+    std::uint8_t* const v_plane = u_plane + chroma_size;
+
+    // Each task converts one row of chroma and the two rows of luma that go with it
+    ThreadPool::global().parallel_for(
+        0, chroma_height,
+        [&](std::size_t chroma_y) {
+            const int y = static_cast<int>(chroma_y) * 2;
+            const bool has_bottom = y + 1 < m_height;
+
+            thread_local std::vector<std::uint8_t> rgb{};
+            thread_local std::vector<std::uint8_t> spare_luma{};
+            const std::size_t row_size = static_cast<std::size_t>(m_width) * 3;
+            rgb.resize(row_size * 2);
+            row_to_rgb8(y, rgb.data());
+            if (has_bottom) {
+                row_to_rgb8(y + 1, rgb.data() + row_size);
+            } else {
+                // The last row of an odd height is its own pair
+                std::memcpy(rgb.data() + row_size, rgb.data(), row_size);
+                spare_luma.resize(m_width);
+            }
+
+            std::uint8_t* const y_top = y_plane + static_cast<std::size_t>(y) * m_width;
+            std::uint8_t* const y_bottom = has_bottom ? y_top + m_width : spare_luma.data();
+            const std::size_t chroma_offset = chroma_y * chroma_width;
+            rgb8_to_yuv420_rows(rgb.data(), rgb.data() + row_size, m_width, y_top, y_bottom, u_plane + chroma_offset,
+                                v_plane + chroma_offset);
+        },
+        8);
+
+    return data;
+}
+
+void FrameBuffer::row_to_rgb8(int y, std::uint8_t* out) const {
+    const std::size_t row_size = static_cast<std::size_t>(m_width) * 3;
+
+    // Bring the row into linear floats first, whatever the storage format is
+    thread_local std::vector<float> row{};
+    row.resize(row_size);
+    if (m_format == Format::RGB32F) {
+        std::memcpy(row.data(), pixel_at(0, y), row_size * sizeof(float));
+    } else {
+        for (int x = 0; x < m_width; ++x) {
+            const Color3 color = unpack(pixel_at(x, y));
+            std::memcpy(row.data() + x * 3, &color[0], 3 * sizeof(float));
         }
     }
+    gamma_encoder().encode(row.data(), row_size, out);
+}
+
+void FrameBuffer::write(const std::string& filename) const {
+    std::string extension = std::filesystem::path{filename}.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
 
-    stbi_write_png(filename.c_str(), m_width, m_height, 4, data.data(), m_width * 4);
+    const std::vector<std::uint8_t> data = to_rgb8();
+    if (extension == ".png") {
+        write_png(filename, m_width, m_height, data);
+    } else if (extension == ".ppm") {
+        write_ppm(filename, m_width, m_height, data);
+    } else if (extension == ".qoi") {
+        write_qoi(filename, m_width, m_height, data);
+    } else {
+        throw std::runtime_error("Unsupported image format: " + filename);
+    }
     std::cout << "Wrote image to " << filename << std::endl;
 }
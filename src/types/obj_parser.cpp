@@ -0,0 +1,103 @@
+#include "types/obj_parser.hpp" // self
+
+#include <algorithm>
+#include <charconv> // std::from_chars
+#include <stdexcept>
+
+namespace {
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+void skip_spaces(const char*& it, const char* end) {
+    while (it != end && is_space(*it)) {
+        ++it;
+    }
+}
+
+void skip_token(const char*& it, const char* end) {
+    while (it != end && !is_space(*it) && *it != '\n') {
+        ++it;
+    }
+}
+
+bool parse_float(const char*& it, const char* end, float& value) {
+    skip_spaces(it, end);
+    if (it != end && *it == '+') {
+        ++it; // from_chars doesn't accept an explicit plus sign
+    }
+    auto [next, error] = std::from_chars(it, end, value);
+    if (error != std::errc{}) {
+        return false;
+    }
+    it = next;
+    return true;
+}
+
+// Parses a face corner in any of the `v`, `v/vt`, `v//vn` or `v/vt/vn` forms - only the position index is kept
+bool parse_corner(const char*& it, const char* end, int& index) {
+    skip_spaces(it, end);
+    auto [next, error] = std::from_chars(it, end, index);
+    if (error != std::errc{}) {
+        return false;
+    }
+    it = next;
+    skip_token(it, end);
+    return true;
+}
+
+} // namespace
+
+void parse_obj_chunk(std::string_view text, ParsedObjChunk& chunk, const std::string& filename) {
+    std::vector<int> corners{};
+
+    const char* it = text.data();
+    const char* end = text.data() + text.size();
+    while (it != end) {
+        skip_spaces(it, end);
+        const char* line_end = std::find(it, end, '\n');
+
+        if (line_end - it >= 2 && it[0] == 'v' && is_space(it[1])) {
+            // A position - the space after the 'v' rules out 'vt' and 'vn'
+            it += 1;
+            Vec3f vertex{};
+            if (!parse_float(it, line_end, vertex.x()) || !parse_float(it, line_end, vertex.y()) ||
+                !parse_float(it, line_end, vertex.z())) {
+                throw std::runtime_error("Malformed vertex in " + filename + ": " + std::string(it, line_end));
+            }
+            chunk.vertices.emplace_back(vertex);
+        } else if (line_end - it >= 2 && it[0] == 'f' && is_space(it[1])) {
+            it += 1;
+            corners.clear();
+            int index = 0;
+            while (parse_corner(it, line_end, index)) {
+                if (index == 0) {
+                    throw std::runtime_error("Face with a vertex index of 0 in " + filename);
+                }
+                corners.push_back(index);
+            }
+            if (corners.size() < 3) {
+                throw std::runtime_error("Face with fewer than 3 vertices in " + filename);
+            }
+
+            // Split polygons into a fan of triangles around their first corner
+            for (std::size_t i = 1; i + 1 < corners.size(); ++i) {
+                Object::Face face{};
+                for (std::size_t k = 0; k < 3; ++k) {
+                    int corner = corners[k == 0 ? 0 : i + k - 1];
+                    if (corner > 0) {
+                        // Subtract 1 to convert to 0-based indexing
+                        face[k] = corner - 1;
+                    } else {
+                        // Counted back from the latest vertex
+                        face[k] = static_cast<int>(chunk.vertices.size()) + corner;
+                        chunk.relative_corners.push_back(chunk.faces.size() * 3 + k);
+                    }
+                }
+                chunk.faces.emplace_back(face);
+            }
+        }
+        // Anything else (texture coordinates, normals, groups, materials, comments, ...) isn't used
+
+        it = line_end == end ? end : line_end + 1;
+    }
+}
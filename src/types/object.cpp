@@ -1,56 +1,304 @@
 #include "types/object.hpp"
+#include "types/mesh_file.hpp"
+#include "types/obj_parser.hpp"
 #include "types/vec.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
 
+#include <unistd.h> // getpid
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <numbers>
+#include <string_view>
+
+namespace {
+
+// Files are parsed in chunks of at least this many bytes - smaller ones aren't worth a thread
+constexpr std::size_t min_chunk_bytes = 256 * 1024;
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float) && sizeof(Object::Face) == 3 * sizeof(std::int32_t),
+              "Mesh files store vertices and faces exactly as they are laid out in memory");
+
+std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + mesh_file_alignment - 1) / mesh_file_alignment * mesh_file_alignment;
+}
 
-Object::Object(const std::string& filename) { load_obj(filename); }
+// The size and modification time of `source`, as recorded in mesh file headers
+std::pair<std::uint64_t, std::int64_t> source_stamp(const std::string& source) {
+    return {std::filesystem::file_size(source),
+            static_cast<std::int64_t>(std::filesystem::last_write_time(source).time_since_epoch().count())};
+}
+
+// Checks that the mapping holds a complete mesh file of the current version, and returns its header
+const MeshFileHeader& validate_mesh_file(const MappedFile& file, const std::string& filename) {
+    if (file.size() < sizeof(MeshFileHeader)) {
+        throw std::runtime_error("Mesh file is too small to be valid: " + filename);
+    }
+
+    const auto& header = *reinterpret_cast<const MeshFileHeader*>(file.data());
+    if (std::memcmp(header.magic, mesh_file_magic, sizeof(mesh_file_magic)) != 0) {
+        throw std::runtime_error("Not a mesh file: " + filename);
+    }
+    if (header.version != mesh_file_version) {
+        throw std::runtime_error("Unsupported mesh file version " + std::to_string(header.version) + ": " + filename);
+    }
+
+    // Compared by what is left of the file after each offset, so that huge counts can't wrap around and pass
+    auto fits = [&](std::uint64_t offset, std::uint64_t count, std::size_t element_size) {
+        return offset % mesh_file_alignment == 0 && offset <= file.size() &&
+               count <= (file.size() - offset) / element_size;
+    };
+    if (!fits(header.vertex_offset, header.vertex_count, sizeof(Vec3f)) ||
+        !fits(header.face_offset, header.face_count, sizeof(Object::Face))) {
+        throw std::runtime_error("Mesh file is truncated or corrupt: " + filename);
+    }
+
+    // The faces are used in place and never checked again, so every index has to be in range before they are. Read
+    // as unsigned, negative indexes are out of range too
+    const auto* faces = reinterpret_cast<const std::uint32_t*>(file.data() + header.face_offset);
+    std::uint32_t largest_index = 0;
+    for (std::size_t i = 0; i < header.face_count * 3; ++i) {
+        largest_index = std::max(largest_index, faces[i]);
+    }
+    if (header.face_count > 0 && largest_index >= header.vertex_count) {
+        throw std::runtime_error("Mesh file has faces that reference vertices that don't exist: " + filename);
+    }
+
+    return header;
+}
+
+// Whether `cache` exists and was converted from the current version of `source`
+bool is_fresh_cache(const std::string& cache, const std::string& source) {
+    std::ifstream file(cache, std::ios::binary);
+    MeshFileHeader header{};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+
+    return std::memcmp(header.magic, mesh_file_magic, sizeof(mesh_file_magic)) == 0 &&
+           header.version == mesh_file_version &&
+           std::pair{header.source_size, header.source_mtime} == source_stamp(source);
+}
+
+} // namespace
+
+Object::Object(const std::string& filename) {
+    if (filename.ends_with(mesh_file_extension)) {
+        load_mesh(filename);
+        return;
+    }
+
+    const std::string cache = filename + mesh_file_extension;
+    if (is_fresh_cache(cache, filename)) {
+        load_mesh(cache);
+        return;
+    }
+
+    load_obj(filename);
+    try {
+        save_mesh(cache, filename);
+    } catch (const std::exception& e) {
+        // Not being able to cache the mesh only costs time on the next load
+        std::cerr << "[WARNING] " << e.what() << std::endl;
+    }
+}
+
+Object::Object(std::vector<Vec3f> vertices, std::vector<Face> faces)
+    : m_vertices{std::move(vertices)}, m_faces{std::move(faces)}, m_bounds{Bounds3f::of(m_vertices)} {}
 
 void Object::load_obj(const std::string& filename) {
-    // Load the model from the file
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file: " + filename);
+    PROFILE_STAGE("Object::load_obj");
+
+    MappedFile file{filename};
+    std::string_view text = file.text();
+
+    // Split the file into chunks that end on line breaks
+    ThreadPool& pool = ThreadPool::global();
+    const std::size_t num_chunks = std::clamp<std::size_t>(text.size() / min_chunk_bytes, 1, pool.concurrency() * 4);
+    std::vector<std::size_t> boundaries(num_chunks + 1, text.size());
+    boundaries[0] = 0;
+    for (std::size_t i = 1; i < num_chunks; ++i) {
+        std::size_t line_break = text.find('\n', std::max(text.size() * i / num_chunks, boundaries[i - 1]));
+        boundaries[i] = line_break == std::string_view::npos ? text.size() : line_break + 1;
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        if (line.empty()) {
-            continue;
-        }
+    std::vector<ParsedObjChunk> chunks(num_chunks);
+    pool.parallel_for(0, num_chunks, [&](std::size_t i) {
+        parse_obj_chunk(text.substr(boundaries[i], boundaries[i + 1] - boundaries[i]), chunks[i], filename);
+    });
 
-        std::istringstream iss(line);
-        char type;
-        iss >> type;
-        // Check that there's a space after the 'v' (to avoid reading 'vt' or 'vn')
-        if (type == 'v' && iss.peek() == ' ') {
-            Vec3f vertex{};
-            iss >> vertex.x() >> vertex.y() >> vertex.z();
-            m_vertices.emplace_back(vertex);
-        } else if (type == 'f') {
-            Face face{};
-            for (int i = 0; i < 3; i++) {
-                std::string vertex_data;
-                // Read up to the slash (only vertex index)
-                std::getline(iss, vertex_data, '/');
-                // Subtract 1 to convert to 0-based indexing
-                face[i] = std::stoi(vertex_data) - 1;
-                // Skip the rest of the data
-                std::getline(iss, vertex_data, ' ');
-            }
+    // Work out where every chunk lands in the merged arrays
+    std::vector<std::size_t> vertex_offsets(num_chunks + 1, 0);
+    std::vector<std::size_t> face_offsets(num_chunks + 1, 0);
+    for (std::size_t i = 0; i < num_chunks; ++i) {
+        vertex_offsets[i + 1] = vertex_offsets[i] + chunks[i].vertices.size();
+        face_offsets[i + 1] = face_offsets[i] + chunks[i].faces.size();
+    }
+
+    m_vertices.resize(vertex_offsets[num_chunks]);
+    m_faces.resize(face_offsets[num_chunks]);
 
-            m_faces.emplace_back(face);
+    pool.parallel_for(0, num_chunks, [&](std::size_t i) {
+        ParsedObjChunk& chunk = chunks[i];
+        for (std::size_t corner : chunk.relative_corners) {
+            chunk.faces[corner / 3][corner % 3] += static_cast<int>(vertex_offsets[i]);
+        }
+        for (const Face& face : chunk.faces) {
+            for (int index : face) {
+                if (index < 0 || static_cast<std::size_t>(index) >= m_vertices.size()) {
+                    throw std::runtime_error("Face references a vertex that doesn't exist in " + filename + ": " +
+                                             std::to_string(index + 1));
+                }
+            }
         }
-    }
+
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), m_vertices.begin() + vertex_offsets[i]);
+        std::copy(chunk.faces.begin(), chunk.faces.end(), m_faces.begin() + face_offsets[i]);
+    });
+
+    m_bounds = Bounds3f::of(m_vertices);
+    m_mapping = nullptr;
 
     std::cout << "Loaded " << m_vertices.size() << " vertices and " << m_faces.size() << " faces from " << filename
               << std::endl;
 }
 
+void Object::load_mesh(const std::string& filename) {
+    PROFILE_STAGE("Object::load_mesh");
+
+    auto mapping = std::make_shared<const MappedFile>(filename);
+    const MeshFileHeader& header = validate_mesh_file(*mapping, filename);
+
+    m_mapped_vertices = {reinterpret_cast<const Vec3f*>(mapping->data() + header.vertex_offset), header.vertex_count};
+    m_mapped_faces = {reinterpret_cast<const Face*>(mapping->data() + header.face_offset), header.face_count};
+    m_mapping = std::move(mapping);
+
+    if (header.flags & mesh_file_has_bounds) {
+        m_bounds.min = Vec3f{header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]};
+        m_bounds.max = Vec3f{header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]};
+    } else {
+        m_bounds = Bounds3f::of(m_mapped_vertices);
+    }
+
+    m_vertices.clear();
+    m_faces.clear();
+
+    std::cout << "Loaded " << m_mapped_vertices.size() << " vertices and " << m_mapped_faces.size() << " faces from "
+              << filename << std::endl;
+}
+
+void Object::save_mesh(const std::string& filename, const std::string& source) const {
+    PROFILE_STAGE("Object::save_mesh");
+
+    const auto vertex_data = vertices();
+    const auto face_data = faces();
+
+    MeshFileHeader header{};
+    std::memcpy(header.magic, mesh_file_magic, sizeof(mesh_file_magic));
+    header.version = mesh_file_version;
+    header.flags = mesh_file_has_bounds;
+    if (!source.empty()) {
+        std::tie(header.source_size, header.source_mtime) = source_stamp(source);
+    }
+    header.vertex_count = vertex_data.size();
+    header.vertex_offset = align_up(sizeof(MeshFileHeader));
+    header.face_count = face_data.size();
+    header.face_offset = align_up(header.vertex_offset + vertex_data.size_bytes());
+    for (std::size_t i = 0; i < 3; ++i) {
+        header.bounds_min[i] = m_bounds.min[i];
+        header.bounds_max[i] = m_bounds.max[i];
+    }
+
+    // Write to a temporary file first, so that other processes never map a half written mesh
+    const std::string temporary = filename + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file for writing: " + temporary);
+        }
+
+        const std::vector<char> padding(mesh_file_alignment, 0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(padding.data(), header.vertex_offset - sizeof(header));
+        file.write(reinterpret_cast<const char*>(vertex_data.data()), vertex_data.size_bytes());
+        file.write(padding.data(), header.face_offset - (header.vertex_offset + vertex_data.size_bytes()));
+        file.write(reinterpret_cast<const char*>(face_data.data()), face_data.size_bytes());
+
+        if (!file) {
+            std::filesystem::remove(temporary);
+            throw std::runtime_error("Failed to write mesh file: " + filename);
+        }
+    }
+    std::filesystem::rename(temporary, filename);
+}
+
+Object Object::sphere(int slices, int stacks) {
+    if (slices < 3 || stacks < 2) {
+        throw std::runtime_error("A sphere needs at least 3 slices and 2 stacks, got " + std::to_string(slices) +
+                                 " and " + std::to_string(stacks));
+    }
+
+    // A pole at each end, with a ring of `slices` vertices between every pair of stacks
+    Object object{};
+    object.m_vertices.reserve(2 + static_cast<std::size_t>(slices) * (stacks - 1));
+    object.m_vertices.push_back({0.f, 1.f, 0.f});
+    for (int stack = 1; stack < stacks; ++stack) {
+        const float polar = std::numbers::pi_v<float> * static_cast<float>(stack) / static_cast<float>(stacks);
+        for (int slice = 0; slice < slices; ++slice) {
+            const float azimuth = 2.f * std::numbers::pi_v<float> * static_cast<float>(slice) / slices;
+            object.m_vertices.push_back(
+                {std::sin(polar) * std::cos(azimuth), std::cos(polar), std::sin(polar) * std::sin(azimuth)});
+        }
+    }
+    object.m_vertices.push_back({0.f, -1.f, 0.f});
+
+    // Faces wind counter-clockwise when seen from outside of the sphere
+    const int south = static_cast<int>(object.m_vertices.size()) - 1;
+    auto ring = [&](int stack, int slice) { return 1 + (stack - 1) * slices + slice % slices; };
+    object.m_faces.reserve(2 * static_cast<std::size_t>(slices) * (stacks - 1));
+    for (int slice = 0; slice < slices; ++slice) {
+        object.m_faces.push_back({0, ring(1, slice + 1), ring(1, slice)});
+        for (int stack = 1; stack + 1 < stacks; ++stack) {
+            object.m_faces.push_back({ring(stack, slice), ring(stack, slice + 1), ring(stack + 1, slice)});
+            object.m_faces.push_back({ring(stack, slice + 1), ring(stack + 1, slice + 1), ring(stack + 1, slice)});
+        }
+        object.m_faces.push_back({ring(stacks - 1, slice), ring(stacks - 1, slice + 1), south});
+    }
+
+    object.m_bounds = Bounds3f::of(object.m_vertices);
+    return object;
+}
+
+Object Object::cube() {
+    Object object{};
+    for (int corner = 0; corner < 8; ++corner) {
+        object.m_vertices.push_back({corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f});
+    }
+
+    // Two triangles per side, wound counter-clockwise when seen from outside of the cube
+    object.m_faces = {
+        {0, 2, 3}, {0, 3, 1}, // -z
+        {4, 5, 7}, {4, 7, 6}, // +z
+        {0, 4, 6}, {0, 6, 2}, // -x
+        {1, 3, 7}, {1, 7, 5}, // +x
+        {0, 1, 5}, {0, 5, 4}, // -y
+        {2, 6, 7}, {2, 7, 3}, // +y
+    };
+
+    object.m_bounds = Bounds3f::of(object.m_vertices);
+    return object;
+}
+
 Object Object::triangle(Vec3f a, Vec3f b, Vec3f c) {
     Object object{};
     object.m_vertices = {a, b, c};
     object.m_faces = {{0, 1, 2}};
+    object.m_bounds = Bounds3f::of(object.m_vertices);
     return object;
 }
@@ -0,0 +1,22 @@
+#include "types/transform.hpp" // self
+
+#include <cmath>
+
+Matrix4x4f Transform::matrix() const {
+    const float cx = std::cos(rotation.x());
+    const float sx = std::sin(rotation.x());
+    const float cy = std::cos(rotation.y());
+    const float sy = std::sin(rotation.y());
+    const float cz = std::cos(rotation.z());
+    const float sz = std::sin(rotation.z());
+
+    // Rz * Ry * Rx, with each column scaled and the translation in the last column
+    return Matrix4x4f{
+        Vec4f{cy * cz * scale.x(), (sx * sy * cz - cx * sz) * scale.y(), (cx * sy * cz + sx * sz) * scale.z(),
+              position.x()},
+        Vec4f{cy * sz * scale.x(), (sx * sy * sz + cx * cz) * scale.y(), (cx * sy * sz - sx * cz) * scale.z(),
+              position.y()},
+        Vec4f{-sy * scale.x(), sx * cy * scale.y(), cx * cy * scale.z(), position.z()},
+        Vec4f{0.f, 0.f, 0.f, 1.f},
+    };
+}
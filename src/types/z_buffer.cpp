@@ -0,0 +1,122 @@
+#include "types/z_buffer.hpp" // self
+#include "utils/profiling.hpp"
+
+#include <xsimd/xsimd.hpp> // SIMD batches
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+using Batch = xsimd::batch<float>;
+constexpr int lanes = static_cast<int>(Batch::size);
+
+} // namespace
+
+std::size_t ZBuffer::covered() const {
+    constexpr float cleared = -std::numeric_limits<float>::infinity();
+
+    std::size_t count = 0;
+    for (int cell_y = 0; cell_y * cell_size < m_height; ++cell_y) {
+        for (int cell_x = 0; cell_x < m_cells_x; ++cell_x) {
+            if (cell_max(cell_x, cell_y) == cleared) {
+                // Nothing in the cell has been written to
+                continue;
+            }
+
+            const int x_0 = cell_x * cell_size;
+            const int x_1 = std::min(x_0 + cell_size, m_width);
+            for (int y = cell_y * cell_size; y < std::min((cell_y + 1) * cell_size, m_height); ++y) {
+                const float* depths = m_buffer.data() + y * m_width;
+                count += std::count_if(depths + x_0, depths + x_1, [](float z) { return z != cleared; });
+            }
+        }
+    }
+    return count;
+}
+
+void ZBuffer::clear(const Rect2i& region) {
+    const Rect2i pixels = region.intersect({{0, 0}, {m_width, m_height}});
+    if (pixels.empty()) {
+        return;
+    }
+
+    for (int y = pixels.min.y(); y < pixels.max.y(); ++y) {
+        float* depths = m_buffer.data() + y * m_width;
+        std::fill(depths + pixels.min.x(), depths + pixels.max.x(), -std::numeric_limits<float>::infinity());
+    }
+    for (int cell_y = pixels.min.y() / cell_size; cell_y <= (pixels.max.y() - 1) / cell_size; ++cell_y) {
+        for (int cell_x = pixels.min.x() / cell_size; cell_x <= (pixels.max.x() - 1) / cell_size; ++cell_x) {
+            m_cells[cell_y * m_cells_x + cell_x] = Cell{};
+        }
+    }
+}
+
+bool ZBuffer::hides(const Rect2i& pixels, float z) const {
+    const Rect2i clipped = pixels.intersect({{0, 0}, {m_width, m_height}});
+    if (clipped.empty()) {
+        return true;
+    }
+
+    for (int cell_y = clipped.min.y() / cell_size; cell_y <= (clipped.max.y() - 1) / cell_size; ++cell_y) {
+        for (int cell_x = clipped.min.x() / cell_size; cell_x <= (clipped.max.x() - 1) / cell_size; ++cell_x) {
+            if (z > cell_min(cell_x, cell_y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void ZBuffer::update_cells(const Rect2i& region) {
+    PROFILE_FINE("ZBuffer::update_cells"); // Add Tracy profiling for this function
+
+    const Rect2i clipped = region.intersect({{0, 0}, {m_width, m_height}});
+    if (clipped.empty()) {
+        return;
+    }
+
+    // Widen to whole cells
+    const int first_x = clipped.min.x() / cell_size * cell_size;
+    const int last_x = std::min(m_width, (clipped.max.x() + cell_size - 1) / cell_size * cell_size);
+    const int width = last_x - first_x;
+
+    // Fold each band of rows down to one row of per-column extremes first, a batch of columns at a time
+    thread_local std::vector<float> lows;
+    thread_local std::vector<float> highs;
+    lows.resize(width);
+    highs.resize(width);
+
+    for (int cell_y = clipped.min.y() / cell_size; cell_y * cell_size < clipped.max.y(); ++cell_y) {
+        const int band_end = std::min(m_height, (cell_y + 1) * cell_size);
+
+        const float* first_row = row(cell_y * cell_size) + first_x;
+        int i = 0;
+        for (; i + lanes <= width; i += lanes) {
+            Batch low = Batch::load_unaligned(first_row + i);
+            Batch high = low;
+            for (int y = cell_y * cell_size + 1; y < band_end; ++y) {
+                const Batch depths = Batch::load_unaligned(row(y) + first_x + i);
+                low = xsimd::min(low, depths);
+                high = xsimd::max(high, depths);
+            }
+            low.store_unaligned(lows.data() + i);
+            high.store_unaligned(highs.data() + i);
+        }
+        for (; i < width; ++i) {
+            lows[i] = highs[i] = first_row[i];
+            for (int y = cell_y * cell_size + 1; y < band_end; ++y) {
+                lows[i] = std::min(lows[i], row(y)[first_x + i]);
+                highs[i] = std::max(highs[i], row(y)[first_x + i]);
+            }
+        }
+
+        for (int x = first_x; x < last_x; x += cell_size) {
+            const int begin = x - first_x;
+            const int end = std::min(begin + cell_size, width);
+            Cell& cell = m_cells[cell_y * m_cells_x + x / cell_size];
+            cell.min = *std::min_element(lows.begin() + begin, lows.begin() + end);
+            cell.max = *std::max_element(highs.begin() + begin, highs.begin() + end);
+        }
+    }
+}
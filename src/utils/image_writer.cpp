@@ -0,0 +1,543 @@
+#include "utils/image_writer.hpp" // self
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using Bytes = std::vector<std::uint8_t>;
+
+constexpr std::size_t channels = 3;
+
+void check_size(int width, int height, std::span<const std::uint8_t> rgb) {
+    if (width <= 0 || height <= 0 || rgb.size() != static_cast<std::size_t>(width) * height * channels) {
+        throw std::invalid_argument("Image data doesn't match its size: " + std::to_string(width) + "x" +
+                                    std::to_string(height));
+    }
+}
+
+std::ofstream open_output(const std::string& filename) {
+    std::ofstream file{filename, std::ios::binary | std::ios::trunc};
+    if (!file) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+    return file;
+}
+
+void write_bytes(std::ofstream& file, std::span<const std::uint8_t> bytes) {
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+void finish_output(std::ofstream& file, const std::string& filename) {
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write file: " + filename);
+    }
+}
+
+void append_u32_be(Bytes& out, std::uint32_t value) {
+    out.push_back(static_cast<std::uint8_t>(value >> 24));
+    out.push_back(static_cast<std::uint8_t>(value >> 16));
+    out.push_back(static_cast<std::uint8_t>(value >> 8));
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+// -- Checksums --
+
+const std::array<std::uint32_t, 256>& crc_table() {
+    static const std::array<std::uint32_t, 256> table = []() {
+        std::array<std::uint32_t, 256> result{};
+        for (std::uint32_t i = 0; i < result.size(); ++i) {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+            }
+            result[i] = crc;
+        }
+        return result;
+    }();
+    return table;
+}
+
+std::uint32_t crc32(std::span<const std::uint8_t> bytes, std::uint32_t crc = 0) {
+    const auto& table = crc_table();
+    crc = ~crc;
+    for (std::uint8_t byte : bytes) {
+        crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+constexpr std::uint32_t adler_base = 65521;
+
+std::uint32_t adler32(std::span<const std::uint8_t> bytes) {
+    // 5552 is the most bytes that can be summed before the 32-bit sums could overflow
+    constexpr std::size_t max_run = 5552;
+    std::uint32_t a = 1;
+    std::uint32_t b = 0;
+    for (std::size_t start = 0; start < bytes.size(); start += max_run) {
+        const std::size_t stop = std::min(bytes.size(), start + max_run);
+        for (std::size_t i = start; i < stop; ++i) {
+            a += bytes[i];
+            b += a;
+        }
+        a %= adler_base;
+        b %= adler_base;
+    }
+    return (b << 16) | a;
+}
+
+// The checksum of two blocks back to back, from the checksums of each block
+std::uint32_t adler32_combine(std::uint32_t first, std::uint32_t second, std::size_t second_size) {
+    const std::uint32_t remainder = static_cast<std::uint32_t>(second_size % adler_base);
+    std::uint32_t a = first & 0xffff;
+    std::uint32_t b = (remainder * a) % adler_base;
+    a += (second & 0xffff) + adler_base - 1;
+    b += (first >> 16) + (second >> 16) + adler_base - remainder;
+    a %= adler_base;
+    b %= adler_base;
+    return (b << 16) | a;
+}
+
+// -- Deflate, using the fixed Huffman codes only --
+
+// Deflate writes bits starting from the least significant bit of each byte
+class BitWriter {
+public:
+    explicit BitWriter(Bytes& out) : m_out{out} {}
+
+    // `length` can be up to 32 bits
+    void put(std::uint32_t value, int length) {
+        m_bits |= static_cast<std::uint64_t>(value) << m_count;
+        m_count += length;
+        if (m_count >= 32) {
+            for (int i = 0; i < 4; ++i) {
+                m_out.push_back(static_cast<std::uint8_t>(m_bits >> (8 * i)));
+            }
+            m_bits >>= 32;
+            m_count -= 32;
+        }
+    }
+
+    // Pads with zero bits up to the next byte
+    void align() {
+        while (m_count > 0) {
+            m_out.push_back(static_cast<std::uint8_t>(m_bits));
+            m_bits >>= 8;
+            m_count = std::max(0, m_count - 8);
+        }
+        m_bits = 0;
+    }
+
+private:
+    Bytes& m_out;
+    std::uint64_t m_bits{0};
+    int m_count{0};
+};
+
+// A Huffman code already reversed for the LSB first bit order, with any extra bits appended after it
+struct Code {
+    std::uint32_t bits{0};
+    int length{0};
+};
+
+constexpr std::uint32_t reverse_bits(std::uint32_t value, int length) {
+    std::uint32_t result = 0;
+    for (int i = 0; i < length; ++i) {
+        result = (result << 1) | ((value >> i) & 1);
+    }
+    return result;
+}
+
+constexpr Code fixed_literal_code(int symbol) {
+    if (symbol < 144) {
+        return {reverse_bits(0x30 + symbol, 8), 8};
+    } else if (symbol < 256) {
+        return {reverse_bits(0x190 + symbol - 144, 9), 9};
+    } else if (symbol < 280) {
+        return {reverse_bits(symbol - 256, 7), 7};
+    }
+    return {reverse_bits(0xc0 + symbol - 280, 8), 8};
+}
+
+constexpr int min_match = 3;
+constexpr int max_match = 258;
+constexpr int window_size = 32768;
+
+constexpr std::array<Code, 256> literal_codes = []() {
+    std::array<Code, 256> result{};
+    for (int i = 0; i < 256; ++i) {
+        result[i] = fixed_literal_code(i);
+    }
+    return result;
+}();
+
+// The length code and extra bits of every match length
+constexpr std::array<Code, max_match + 1> length_codes = []() {
+    constexpr std::array<int, 29> base{3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    constexpr std::array<int, 29> extra{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                        2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    std::array<Code, max_match + 1> result{};
+    for (int length = min_match; length <= max_match; ++length) {
+        int index = 28;
+        while (base[index] > length) {
+            --index;
+        }
+        const Code code = fixed_literal_code(257 + index);
+        result[length] = {code.bits | (static_cast<std::uint32_t>(length - base[index]) << code.length),
+                          code.length + extra[index]};
+    }
+    return result;
+}();
+
+constexpr Code end_of_block = fixed_literal_code(256);
+
+// The distance codes split the range up by powers of 2 - every power of 2 is split in half by one more code
+Code distance_code(int distance) {
+    const std::uint32_t offset = static_cast<std::uint32_t>(distance - 1);
+    if (offset < 4) {
+        return {reverse_bits(offset, 5), 5};
+    }
+    const int log2 = std::bit_width(offset) - 1;
+    const int extra = log2 - 1;
+    const std::uint32_t symbol = 2 * log2 + ((offset >> extra) & 1);
+    const std::uint32_t extra_bits = offset & ((1u << extra) - 1);
+    return {reverse_bits(symbol, 5) | (extra_bits << 5), 5 + extra};
+}
+
+std::uint32_t load_u32(const std::uint8_t* bytes) {
+    std::uint32_t value = 0;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+// The length of the common prefix of `a` and `b`, up to `limit`
+int match_length(const std::uint8_t* a, const std::uint8_t* b, int limit) {
+    int length = 0;
+    while (length + 8 <= limit) {
+        std::uint64_t x = 0;
+        std::uint64_t y = 0;
+        std::memcpy(&x, a + length, sizeof(x));
+        std::memcpy(&y, b + length, sizeof(y));
+        if (x != y) {
+            return length + std::countr_zero(x ^ y) / 8;
+        }
+        length += 8;
+    }
+    while (length < limit && a[length] == b[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// Compresses `data` as one non-final fixed Huffman block, followed by an empty stored block to get back onto a byte
+// boundary - so the output of separate calls can simply be concatenated. Matches never reach outside of `data`
+void deflate_block(std::span<const std::uint8_t> data, Bytes& out) {
+    constexpr int hash_bits = 15;
+    constexpr int max_chain = 8;
+
+    const std::uint8_t* bytes = data.data();
+    const int size = static_cast<int>(data.size());
+
+    std::vector<int> head(1 << hash_bits, -1);
+    std::vector<int> previous(window_size, -1);
+
+    auto hash = [&](int pos) {
+        // Only the 3 bytes that make up a minimal match go into the hash
+        return ((load_u32(bytes + pos) & 0xffffff) * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](int pos) {
+        const std::uint32_t h = hash(pos);
+        previous[pos & (window_size - 1)] = head[h];
+        head[h] = pos;
+    };
+
+    BitWriter writer{out};
+    writer.put(0b010, 3); // Not the final block, fixed Huffman codes
+
+    // Reading 4 bytes for the hash, so stop hashing a little early
+    const int hash_end = size - 4;
+    int pos = 0;
+    while (pos < size) {
+        int best_length = 0;
+        int best_distance = 0;
+        if (pos < hash_end) {
+            const int limit = std::min(max_match, size - pos);
+            int candidate = head[hash(pos)];
+            for (int chain = 0; chain < max_chain && candidate >= 0 && pos - candidate <= window_size; ++chain) {
+                const int length = match_length(bytes + candidate, bytes + pos, limit);
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = pos - candidate;
+                    if (length == limit) {
+                        break;
+                    }
+                }
+                const int next = previous[candidate & (window_size - 1)];
+                if (next >= candidate) {
+                    break; // The slot was reused by a newer position
+                }
+                candidate = next;
+            }
+            insert(pos);
+        }
+
+        if (best_length >= min_match) {
+            const Code length = length_codes[best_length];
+            const Code distance = distance_code(best_distance);
+            writer.put(length.bits, length.length);
+            writer.put(distance.bits, distance.length);
+            for (int i = pos + 1; i < pos + best_length && i < hash_end; ++i) {
+                insert(i);
+            }
+            pos += best_length;
+        } else {
+            const Code literal = literal_codes[bytes[pos]];
+            writer.put(literal.bits, literal.length);
+            ++pos;
+        }
+    }
+
+    writer.put(end_of_block.bits, end_of_block.length);
+
+    // An empty stored block: its header, padding up to the byte boundary and then a length of 0 (and its complement)
+    writer.put(0b000, 3);
+    writer.align();
+    out.insert(out.end(), {0x00, 0x00, 0xff, 0xff});
+}
+
+// -- PNG --
+
+std::uint8_t paeth(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<std::uint8_t>(a);
+    }
+    return static_cast<std::uint8_t>(pb <= pc ? b : c);
+}
+
+// Filters one row with each of the 5 PNG filters, and keeps the one whose output looks the most compressible. Writes
+// the filter type followed by the filtered row to `out`
+void filter_row(const std::uint8_t* row, const std::uint8_t* above, std::size_t row_size, std::uint8_t* out,
+                std::array<Bytes, 5>& scratch) {
+    for (std::size_t i = 0; i < row_size; ++i) {
+        const int x = row[i];
+        const int a = i >= channels ? row[i - channels] : 0;
+        const int b = above[i];
+        const int c = i >= channels ? above[i - channels] : 0;
+        scratch[0][i] = static_cast<std::uint8_t>(x);
+        scratch[1][i] = static_cast<std::uint8_t>(x - a);
+        scratch[2][i] = static_cast<std::uint8_t>(x - b);
+        scratch[3][i] = static_cast<std::uint8_t>(x - (a + b) / 2);
+        scratch[4][i] = static_cast<std::uint8_t>(x - paeth(a, b, c));
+    }
+
+    // Smaller residuals (treated as signed) usually compress better
+    std::size_t best_filter = 0;
+    std::uint64_t best_cost = UINT64_MAX;
+    for (std::size_t filter = 0; filter < scratch.size(); ++filter) {
+        std::uint64_t cost = 0;
+        for (std::size_t i = 0; i < row_size; ++i) {
+            cost += static_cast<std::uint64_t>(std::abs(static_cast<std::int8_t>(scratch[filter][i])));
+        }
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_filter = filter;
+        }
+    }
+
+    out[0] = static_cast<std::uint8_t>(best_filter);
+    std::memcpy(out + 1, scratch[best_filter].data(), row_size);
+}
+
+// A whole chunk: length, type, data and the CRC of the type and data
+void append_chunk(Bytes& out, const char (&type)[5], std::span<const std::uint8_t> data) {
+    append_u32_be(out, static_cast<std::uint32_t>(data.size()));
+    const std::size_t type_start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    append_u32_be(out, crc32({out.data() + type_start, out.size() - type_start}));
+}
+
+} // namespace
+
+void write_png(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb) {
+    PROFILE_STAGE("write_png"); // Add Tracy profiling for this function
+
+    check_size(width, height, rgb);
+
+    const std::size_t row_size = static_cast<std::size_t>(width) * channels;
+    const std::size_t filtered_row_size = row_size + 1;
+
+    // Bands need to be big enough that LZ77 has something to match against, but there should be enough of them to
+    // keep every thread busy
+    ThreadPool& pool = ThreadPool::global();
+    constexpr std::size_t min_band_bytes = 256 * 1024;
+    const std::size_t rows = static_cast<std::size_t>(height);
+    const std::size_t min_band_rows = (min_band_bytes + filtered_row_size - 1) / filtered_row_size;
+    const std::size_t band_rows = std::max(min_band_rows, (rows + pool.concurrency() * 4 - 1) / (pool.concurrency() * 4));
+    const std::size_t band_count = (rows + band_rows - 1) / band_rows;
+
+    // Every band becomes its own IDAT chunk, so that the CRCs can be worked out in parallel too
+    std::vector<Bytes> chunks(band_count);
+    std::vector<std::uint32_t> adlers(band_count);
+    std::vector<std::size_t> filtered_sizes(band_count);
+    const Bytes zero_row(row_size, 0);
+
+    pool.parallel_for(0, band_count, [&](std::size_t band) {
+        const std::size_t first_row = band * band_rows;
+        const std::size_t last_row = std::min(rows, first_row + band_rows);
+
+        Bytes filtered((last_row - first_row) * filtered_row_size);
+        std::array<Bytes, 5> scratch{};
+        for (Bytes& buffer : scratch) {
+            buffer.resize(row_size);
+        }
+        for (std::size_t y = first_row; y < last_row; ++y) {
+            const std::uint8_t* row = rgb.data() + y * row_size;
+            const std::uint8_t* above = y > 0 ? row - row_size : zero_row.data();
+            filter_row(row, above, row_size, filtered.data() + (y - first_row) * filtered_row_size, scratch);
+        }
+        adlers[band] = adler32(filtered);
+        filtered_sizes[band] = filtered.size();
+
+        Bytes compressed{};
+        compressed.reserve(filtered.size() / 2);
+        if (band == 0) {
+            // The zlib header: deflate with a 32K window, no preset dictionary
+            compressed.insert(compressed.end(), {0x78, 0x01});
+        }
+        deflate_block(filtered, compressed);
+
+        append_chunk(chunks[band], "IDAT", compressed);
+    });
+
+    // The zlib stream ends with an empty final block and the checksum of all of the uncompressed data
+    std::uint32_t adler = adlers[0];
+    for (std::size_t band = 1; band < band_count; ++band) {
+        adler = adler32_combine(adler, adlers[band], filtered_sizes[band]);
+    }
+    Bytes trailer{};
+    BitWriter writer{trailer};
+    writer.put(0b011, 3); // The final block, fixed Huffman codes
+    writer.put(end_of_block.bits, end_of_block.length);
+    writer.align();
+    append_u32_be(trailer, adler);
+
+    Bytes header{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    Bytes image_header{};
+    append_u32_be(image_header, static_cast<std::uint32_t>(width));
+    append_u32_be(image_header, static_cast<std::uint32_t>(height));
+    image_header.insert(image_header.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, deflate, adaptive filters, no interlacing
+    append_chunk(header, "IHDR", image_header);
+
+    Bytes footer{};
+    append_chunk(footer, "IDAT", trailer);
+    append_chunk(footer, "IEND", {});
+
+    std::ofstream file = open_output(filename);
+    write_bytes(file, header);
+    for (const Bytes& chunk : chunks) {
+        write_bytes(file, chunk);
+    }
+    write_bytes(file, footer);
+    finish_output(file, filename);
+}
+
+void write_ppm(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb) {
+    PROFILE_STAGE("write_ppm"); // Add Tracy profiling for this function
+
+    check_size(width, height, rgb);
+
+    std::ofstream file = open_output(filename);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    write_bytes(file, rgb);
+    finish_output(file, filename);
+}
+
+void write_qoi(const std::string& filename, int width, int height, std::span<const std::uint8_t> rgb) {
+    PROFILE_STAGE("write_qoi"); // Add Tracy profiling for this function
+
+    check_size(width, height, rgb);
+
+    constexpr std::uint8_t op_index = 0x00;
+    constexpr std::uint8_t op_diff = 0x40;
+    constexpr std::uint8_t op_luma = 0x80;
+    constexpr std::uint8_t op_run = 0xc0;
+    constexpr std::uint8_t op_rgb = 0xfe;
+    constexpr int max_run = 62;
+
+    Bytes out{'q', 'o', 'i', 'f'};
+    out.reserve(rgb.size() / 2);
+    append_u32_be(out, static_cast<std::uint32_t>(width));
+    append_u32_be(out, static_cast<std::uint32_t>(height));
+    out.push_back(static_cast<std::uint8_t>(channels));
+    out.push_back(0); // sRGB - the pixels are gamma corrected
+
+    // Alpha is always 255 here, so it only shows up in the hash
+    std::array<std::array<std::uint8_t, 3>, 64> seen{};
+    std::array<bool, 64> seen_valid{};
+    std::array<std::uint8_t, 3> previous{0, 0, 0};
+    int run = 0;
+
+    const std::size_t pixel_count = rgb.size() / channels;
+    for (std::size_t i = 0; i < pixel_count; ++i) {
+        const std::array<std::uint8_t, 3> pixel{rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]};
+
+        if (pixel == previous) {
+            ++run;
+            if (run == max_run || i + 1 == pixel_count) {
+                out.push_back(static_cast<std::uint8_t>(op_run | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            out.push_back(static_cast<std::uint8_t>(op_run | (run - 1)));
+            run = 0;
+        }
+
+        const std::size_t slot = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + 255 * 11) % 64;
+        if (seen_valid[slot] && seen[slot] == pixel) {
+            out.push_back(static_cast<std::uint8_t>(op_index | slot));
+        } else {
+            seen[slot] = pixel;
+            seen_valid[slot] = true;
+
+            const int dr = static_cast<std::int8_t>(pixel[0] - previous[0]);
+            const int dg = static_cast<std::int8_t>(pixel[1] - previous[1]);
+            const int db = static_cast<std::int8_t>(pixel[2] - previous[2]);
+            const int dr_dg = dr - dg;
+            const int db_dg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back(static_cast<std::uint8_t>(op_diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                out.push_back(static_cast<std::uint8_t>(op_luma | (dg + 32)));
+                out.push_back(static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+            } else {
+                out.insert(out.end(), {op_rgb, pixel[0], pixel[1], pixel[2]});
+            }
+        }
+        previous = pixel;
+    }
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1}); // End marker
+
+    std::ofstream file = open_output(filename);
+    write_bytes(file, out);
+    finish_output(file, filename);
+}
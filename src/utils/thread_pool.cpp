@@ -0,0 +1,137 @@
+#include "utils/thread_pool.hpp" // self
+
+#include <limits>
+
+namespace {
+
+constexpr std::size_t not_a_worker = std::numeric_limits<std::size_t>::max();
+
+// Which of the pool's workers the current thread is, if any
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local std::size_t current_worker = not_a_worker;
+
+} // namespace
+
+ThreadPool::ThreadPool(std::size_t num_workers) {
+    m_queues.reserve(num_workers);
+    for (std::size_t i = 0; i < num_workers; ++i) {
+        m_queues.emplace_back(std::make_unique<Queue>());
+    }
+
+    m_workers.reserve(num_workers);
+    for (std::size_t i = 0; i < num_workers; ++i) {
+        m_workers.emplace_back([this, i]() { worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock{m_wake_mutex};
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool{std::max(1u, std::thread::hardware_concurrency()) - 1};
+    return pool;
+}
+
+std::size_t ThreadPool::thread_index() const { return current_pool == this ? current_worker : m_workers.size(); }
+
+bool ThreadPool::LoopState::claim(std::size_t& begin, std::size_t& stop) {
+    std::size_t current = next.load(std::memory_order_relaxed);
+    std::size_t chunk = 0;
+    do {
+        if (current >= end) {
+            return false;
+        }
+        // Hand out half of an even share of what's left, so chunks shrink towards the end of the range
+        chunk = std::min(end - current, std::max(grain, (end - current) / (2 * participants)));
+    } while (!next.compare_exchange_weak(current, current + chunk, std::memory_order_relaxed));
+
+    begin = current;
+    stop = current + chunk;
+    return true;
+}
+
+void ThreadPool::push(Task task) {
+    if (m_queues.empty()) {
+        // Nothing would ever pick the task up
+        task();
+        return;
+    }
+
+    // Workers keep their own tasks close, everyone else spreads them over the pool
+    const std::size_t index = current_pool == this
+                                  ? current_worker
+                                  : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+    // Counted before it can be seen - a thread that takes the task off the queue straight away counts it back down,
+    // which must never happen first
+    {
+        std::lock_guard lock{m_wake_mutex};
+        ++m_pending;
+    }
+    {
+        std::lock_guard lock{m_queues[index]->mutex};
+        m_queues[index]->tasks.emplace_back(std::move(task));
+    }
+    m_wake.notify_one();
+}
+
+bool ThreadPool::try_run_one() {
+    const std::size_t self = current_pool == this ? current_worker : not_a_worker;
+
+    Task task{};
+    if (self != not_a_worker) {
+        std::lock_guard lock{m_queues[self]->mutex};
+        if (!m_queues[self]->tasks.empty()) {
+            task = std::move(m_queues[self]->tasks.back());
+            m_queues[self]->tasks.pop_back();
+        }
+    }
+
+    // Steal the oldest task of another worker, starting from a neighbour so thieves don't all pile onto one deque
+    const std::size_t first = self == not_a_worker ? 0 : self + 1;
+    for (std::size_t i = 0; !task && i < m_queues.size(); ++i) {
+        auto& victim = *m_queues[(first + i) % m_queues.size()];
+        std::lock_guard lock{victim.mutex};
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+
+    {
+        std::lock_guard lock{m_wake_mutex};
+        --m_pending;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(std::size_t index) {
+    current_pool = this;
+    current_worker = index;
+
+    while (true) {
+        if (try_run_one()) {
+            continue;
+        }
+
+        std::unique_lock lock{m_wake_mutex};
+        m_wake.wait(lock, [this]() { return m_pending > 0 || m_stopping; });
+        if (m_stopping && m_pending == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#include "utils/video_writer.hpp" // self
+#include "utils/profiling.hpp"
+
+#include <stdexcept>
+
+Y4mWriter::Y4mWriter(const std::string& filename, int width, int height, int frames_per_second)
+    : m_filename{filename}, m_width{width}, m_height{height} {
+    if (width <= 0 || height <= 0 || frames_per_second <= 0) {
+        throw std::invalid_argument("Invalid video size or frame rate: " + std::to_string(width) + "x" +
+                                    std::to_string(height) + " at " + std::to_string(frames_per_second) + " fps");
+    }
+
+    if (filename == "-") {
+        m_file = stdout;
+    } else {
+        m_file = std::fopen(filename.c_str(), "wb");
+        m_owns_file = true;
+    }
+    if (m_file == nullptr) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+
+    // Square pixels, progressive, and chroma sited in the middle of each 2x2 block, as it is averaged from all 4
+    const std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" +
+                               std::to_string(frames_per_second) + ":1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+    write(header.data(), header.size());
+}
+
+Y4mWriter::~Y4mWriter() {
+    // Errors can't be reported from here - call close() to find out about them
+    if (m_owns_file && m_file != nullptr) {
+        std::fclose(m_file);
+    } else if (m_file != nullptr) {
+        std::fflush(m_file);
+    }
+}
+
+std::size_t Y4mWriter::frame_size() const {
+    const std::size_t chroma_size = static_cast<std::size_t>((m_width + 1) / 2) * ((m_height + 1) / 2);
+    return static_cast<std::size_t>(m_width) * m_height + 2 * chroma_size;
+}
+
+void Y4mWriter::write_frame(std::span<const std::uint8_t> yuv) {
+    PROFILE_STAGE("Y4mWriter::write_frame"); // Add Tracy profiling for this function
+
+    if (yuv.size() != frame_size()) {
+        throw std::invalid_argument("Frame data doesn't match the video size: " + std::to_string(m_width) + "x" +
+                                    std::to_string(m_height));
+    }
+    constexpr char frame_header[] = "FRAME\n";
+    write(frame_header, sizeof(frame_header) - 1);
+    write(yuv.data(), yuv.size());
+
+    // Hands the whole frame on right away, so that a reader on the other end of a pipe isn't left waiting on it
+    if (std::fflush(m_file) != 0) {
+        throw std::runtime_error("Failed to write video: " + m_filename);
+    }
+}
+
+void Y4mWriter::close() {
+    if (m_file == nullptr) {
+        return;
+    }
+    const bool failed = m_owns_file ? std::fclose(m_file) != 0 : std::fflush(m_file) != 0;
+    m_file = nullptr;
+    if (failed) {
+        throw std::runtime_error("Failed to write video: " + m_filename);
+    }
+}
+
+void Y4mWriter::write(const void* data, std::size_t size) {
+    if (m_file == nullptr) {
+        throw std::runtime_error("Video has already been closed: " + m_filename);
+    }
+    if (std::fwrite(data, 1, size, m_file) != size) {
+        throw std::runtime_error("Failed to write video: " + m_filename);
+    }
+}
@@ -0,0 +1,194 @@
+#include "vertex_stage.hpp" // self
+#include "clipper.hpp"
+#include "utils/profiling.hpp"
+#include "utils/thread_pool.hpp"
+#include "utils/timer.hpp"
+
+#include <xsimd/xsimd.hpp> // SIMD batches
+
+#include <algorithm> // std::copy_n
+#include <array>
+#include <numeric> // std::iota
+
+namespace {
+
+using FloatBatch = xsimd::batch<float>;
+using IntBatch = xsimd::batch<std::int32_t>;
+
+constexpr std::size_t lanes = FloatBatch::size;
+
+// The number of vertices handed to a thread at a time
+constexpr std::size_t block_size = 1024;
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Positions are read as tightly packed xyz triples");
+
+// A matrix with every element broadcast across a batch, so it can be applied to a batch of vertices at once
+struct BroadcastMatrix {
+    std::array<std::array<FloatBatch, 4>, 4> rows{};
+
+    BroadcastMatrix(const Matrix4x4f& matrix) {
+        for (std::size_t i = 0; i < 4; ++i) {
+            for (std::size_t j = 0; j < 4; ++j) {
+                rows[i][j] = FloatBatch(matrix.at(i, j));
+            }
+        }
+    }
+
+    // Row `i` of the matrix multiplied by the points (x, y, z, 1)
+    FloatBatch apply(std::size_t i, const FloatBatch& x, const FloatBatch& y, const FloatBatch& z) const {
+        return xsimd::fma(rows[i][0], x, xsimd::fma(rows[i][1], y, xsimd::fma(rows[i][2], z, rows[i][3])));
+    }
+};
+
+struct TransformedBatch {
+    std::array<FloatBatch, 3> view;
+    std::array<FloatBatch, 4> clip;
+    std::array<FloatBatch, 3> ndc;
+    std::array<IntBatch, 2> screen;
+    IntBatch clip_code;
+};
+
+TransformedBatch transform(const FloatBatch& x, const FloatBatch& y, const FloatBatch& z,
+                           const BroadcastMatrix& model_view, const BroadcastMatrix& mvp, const FloatBatch& width,
+                           const FloatBatch& height, const Vec2f& guard) {
+    TransformedBatch out{};
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        out.view[i] = model_view.apply(i, x, y, z);
+    }
+    for (std::size_t i = 0; i < 4; ++i) {
+        out.clip[i] = mvp.apply(i, x, y, z);
+    }
+
+    // Same planes as clip_code
+    const auto& [x_clip, y_clip, z_clip, w_clip] = out.clip;
+    auto flag = [&](const FloatBatch::batch_bool_type& outside, std::int32_t bit) {
+        out.clip_code |= xsimd::select(xsimd::batch_bool_cast<std::int32_t>(outside), IntBatch(bit), IntBatch(0));
+    };
+    out.clip_code = IntBatch(0);
+    flag(x_clip + w_clip < 0.f, ClipCode::negative_x);
+    flag(w_clip - x_clip < 0.f, ClipCode::positive_x);
+    flag(y_clip + w_clip < 0.f, ClipCode::negative_y);
+    flag(w_clip - y_clip < 0.f, ClipCode::positive_y);
+    flag(w_clip - z_clip < 0.f, ClipCode::near);
+    flag(z_clip + w_clip < 0.f, ClipCode::far);
+    flag(x_clip + guard.x() * w_clip < 0.f, ClipCode::guard_negative_x);
+    flag(guard.x() * w_clip - x_clip < 0.f, ClipCode::guard_positive_x);
+    flag(y_clip + guard.y() * w_clip < 0.f, ClipCode::guard_negative_y);
+    flag(guard.y() * w_clip - y_clip < 0.f, ClipCode::guard_positive_y);
+
+    // TODO: Consider making ndc [0, 1] instead of [-1, 1]
+    const FloatBatch inv_w = 1.f / out.clip[3];
+    for (std::size_t i = 0; i < 3; ++i) {
+        out.ndc[i] = out.clip[i] * inv_w;
+    }
+
+    // Flip both axes so (0, 0) is the top-left corner, truncating like to_screen_space does
+    out.screen[0] = xsimd::batch_cast<std::int32_t>((-out.ndc[0] + 1.f) * 0.5f * width);
+    out.screen[1] = xsimd::batch_cast<std::int32_t>((-out.ndc[1] + 1.f) * 0.5f * height);
+
+    return out;
+}
+
+// Stores the first `count` lanes of `batch` at `destination`. Partial batches go through the stack, so that nothing is
+// written past the end of the stream
+template <typename Batch, typename T> void store_lanes(const Batch& batch, T* destination, std::size_t count) {
+    if (count == Batch::size) {
+        batch.store_unaligned(destination);
+        return;
+    }
+    std::array<T, Batch::size> values{};
+    batch.store_unaligned(values.data());
+    std::copy_n(values.begin(), count, destination);
+}
+
+void store(const TransformedBatch& batch, VertexStreams& out, std::size_t first, std::size_t count = lanes) {
+    store_lanes(batch.view[0], &out.view_x[first], count);
+    store_lanes(batch.view[1], &out.view_y[first], count);
+    store_lanes(batch.view[2], &out.view_z[first], count);
+    store_lanes(batch.clip[0], &out.clip_x[first], count);
+    store_lanes(batch.clip[1], &out.clip_y[first], count);
+    store_lanes(batch.clip[2], &out.clip_z[first], count);
+    store_lanes(batch.clip[3], &out.clip_w[first], count);
+    store_lanes(batch.ndc[0], &out.ndc_x[first], count);
+    store_lanes(batch.ndc[1], &out.ndc_y[first], count);
+    store_lanes(batch.ndc[2], &out.ndc_z[first], count);
+    store_lanes(batch.screen[0], &out.screen_x[first], count);
+    store_lanes(batch.screen[1], &out.screen_y[first], count);
+    store_lanes(batch.clip_code, &out.clip_code[first], count);
+}
+
+} // namespace
+
+void VertexStreams::resize(std::size_t count) {
+    for (auto* stream : {&view_x, &view_y, &view_z, &clip_x, &clip_y, &clip_z, &clip_w, &ndc_x, &ndc_y, &ndc_z}) {
+        stream->resize(count);
+    }
+    screen_x.resize(count);
+    screen_y.resize(count);
+    clip_code.resize(count);
+}
+
+void run_vertex_stage(std::span<const Vec3f> positions, const Matrix4x4f& model_view, const Matrix4x4f& projection,
+                      int width, int height, VertexStreams& out, ThreadPool& pool, bool parallelize) {
+    PROFILE_STAGE("run_vertex_stage");
+
+    Timer timer("Vertex Stage");
+
+    out.resize(positions.size());
+    if (positions.empty()) {
+        return;
+    }
+
+    // Fold the projection into the model-view matrix once, rather than doing two multiplies per vertex
+    const BroadcastMatrix mv{model_view};
+    const BroadcastMatrix mvp{projection * model_view};
+    const FloatBatch width_batch(static_cast<float>(width));
+    const FloatBatch height_batch(static_cast<float>(height));
+    const Vec2f guard = guard_band(width, height);
+
+    std::array<std::int32_t, lanes> lane_indices{};
+    std::iota(lane_indices.begin(), lane_indices.end(), 0);
+    const IntBatch lane_offsets = IntBatch::load_unaligned(lane_indices.data()) * 3;
+
+    const float* xyz = &positions[0][0];
+    const std::size_t num_full = positions.size() / lanes * lanes;
+
+    auto task = [&](std::size_t block) {
+        const std::size_t first = block * block_size;
+        const std::size_t last = std::min(first + block_size, num_full);
+        for (std::size_t i = first; i < last; i += lanes) {
+            // De-interleave the xyz triples into one batch per axis
+            const IntBatch index = lane_offsets + static_cast<std::int32_t>(3 * i);
+            const FloatBatch x = FloatBatch::gather(xyz, index);
+            const FloatBatch y = FloatBatch::gather(xyz + 1, index);
+            const FloatBatch z = FloatBatch::gather(xyz + 2, index);
+
+            store(transform(x, y, z, mv, mvp, width_batch, height_batch, guard), out, i);
+        }
+    };
+
+    const std::size_t num_blocks = (num_full + block_size - 1) / block_size;
+    if (parallelize) {
+        pool.parallel_for(0, num_blocks, task);
+    } else {
+        for (std::size_t block = 0; block < num_blocks; ++block) {
+            task(block);
+        }
+    }
+
+    // The last few vertices don't fill a whole batch - run them through a zero padded one, and keep only their lanes
+    const std::size_t remaining = positions.size() - num_full;
+    if (remaining > 0) {
+        std::array<float, lanes> x{}, y{}, z{};
+        for (std::size_t i = 0; i < remaining; ++i) {
+            x[i] = positions[num_full + i].x();
+            y[i] = positions[num_full + i].y();
+            z[i] = positions[num_full + i].z();
+        }
+
+        store(transform(FloatBatch::load_unaligned(x.data()), FloatBatch::load_unaligned(y.data()),
+                        FloatBatch::load_unaligned(z.data()), mv, mvp, width_batch, height_batch, guard),
+              out, num_full, remaining);
+    }
+}